@@ -0,0 +1,56 @@
+// Recording throughput of MemoryProfiler as the number of threads grows.
+//
+// Build: g++ -std=c++17 -O2 -pthread -I.. bench_concurrent_record.cpp -o bench_concurrent_record
+// Usage: ./bench_concurrent_record [ops-per-thread]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#define MEMPROF_NO_GLOBAL_HOOKS
+#include "memory_profiler.h"
+
+static void worker(size_t ops) {
+    MemoryProfiler& profiler = MemoryProfiler::getInstance();
+    const size_t batch = 64;
+    void* blocks[batch];
+    
+    for (size_t done = 0; done < ops; done += batch) {
+        for (size_t i = 0; i < batch; i++) {
+            size_t size = 16 + (i * 24) % 512;
+            blocks[i] = malloc(size);
+            profiler.recordAllocation(blocks[i], size, __FILE__, __LINE__);
+        }
+        for (size_t i = 0; i < batch; i++) {
+            profiler.recordDeallocation(blocks[i]);
+            free(blocks[i]);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t opsPerThread = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+    const int threadCounts[] = {1, 2, 4, 8, 16, 32, 64};
+    
+    printf("%8s %14s %14s %12s\n", "threads", "records", "records/sec", "ns/record");
+    for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); t++) {
+        int threads = threadCounts[t];
+        std::vector<std::thread> pool;
+        
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < threads; i++) {
+            pool.push_back(std::thread(worker, opsPerThread));
+        }
+        for (size_t i = 0; i < pool.size(); i++) {
+            pool[i].join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        
+        // One allocation and one deallocation record per operation.
+        double records = 2.0 * opsPerThread * threads;
+        printf("%8d %14.0f %14.0f %12.1f\n", threads, records, records / seconds,
+               seconds * 1e9 / records * threads);
+    }
+    return 0;
+}
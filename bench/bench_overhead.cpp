@@ -0,0 +1,447 @@
+// Time and memory the profiler adds to tracked new/delete, against malloc
+// and free alone, over four workloads at 1 to N threads:
+//
+//     churn   replaces random blocks of 16-256 bytes in a working set
+//     large   the same with blocks of 64 KB-1 MB, one byte written per page
+//     cross   each thread allocates and a partner thread frees (N pairs)
+//     stl     std::map, std::string and std::vector insert and erase
+//
+// Every measurement runs in a forked child, so each gets a fresh profiler
+// and its own peak RSS, and the best of --repeat runs is kept. Tracked runs
+// go through memprofAllocate and memprofDeallocate, the functions behind
+// the global operator new and delete.
+//
+// --json writes the results as a baseline; --baseline compares against one
+// and exits 1 when a workload's time ratio to malloc, or its extra RSS,
+// grew by more than --threshold (a fraction). `make bench-baseline` and
+// `make bench-check` run both with fixed thread counts.
+//
+// Build: g++ -std=c++17 -O2 -pthread -I.. bench_overhead.cpp -o bench_overhead -ldl
+// Usage: ./bench_overhead [--ops n] [--threads n] [--repeat n] [--json file]
+//                         [--baseline file] [--threshold fraction]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+// Both heaps are called explicitly below; the global operator new/delete
+// replacements would make the malloc baseline tracked too.
+#define MEMPROF_NO_GLOBAL_HOOKS
+#include "memory_profiler.h"
+
+struct RawHeap {
+    static void* allocate(size_t size) { return malloc(size); }
+    static void release(void* ptr) { free(ptr); }
+};
+
+struct TrackedHeap {
+    MEMPROF_NOINLINE static void* allocate(size_t size) {
+        return memprofAllocate(size, 0, false, NULL, 0, MEMPROF_CALLER(), ALLOC_NEW);
+    }
+    MEMPROF_NOINLINE static void release(void* ptr) { memprofDeallocate(ptr, false, ALLOC_NEW, MEMPROF_CALLER()); }
+};
+
+// Routes the containers of the stl workload to one heap.
+template <typename T, typename Heap>
+struct HeapAllocator {
+    typedef T value_type;
+    
+    HeapAllocator() {}
+    template <typename U>
+    HeapAllocator(const HeapAllocator<U, Heap>&) {}
+    
+    template <typename U>
+    struct rebind {
+        typedef HeapAllocator<U, Heap> other;
+    };
+    
+    T* allocate(size_t count) {
+        void* ptr = Heap::allocate(count * sizeof(T));
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(ptr);
+    }
+    void deallocate(T* ptr, size_t) { Heap::release(ptr); }
+    
+    template <typename U>
+    bool operator==(const HeapAllocator<U, Heap>&) const { return true; }
+    template <typename U>
+    bool operator!=(const HeapAllocator<U, Heap>&) const { return false; }
+};
+
+// Cheap per-thread generator, so random sizes cost next to nothing.
+struct Random {
+    uint64_t state;
+    
+    explicit Random(uint64_t seed) : state(seed * 0x9e3779b97f4a7c15ULL + 1) {}
+    
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return static_cast<uint32_t>(state >> 32);
+    }
+};
+
+template <typename Heap>
+static void replaceBlocks(size_t ops, size_t slots, size_t minSize, size_t maxSize, bool touch, uint64_t seed) {
+    std::vector<void*> blocks(slots, static_cast<void*>(NULL));
+    Random random(seed);
+    for (size_t i = 0; i < ops; i++) {
+        size_t slot = random.next() % slots;
+        Heap::release(blocks[slot]);
+        size_t size = minSize + random.next() % (maxSize - minSize + 1);
+        char* block = static_cast<char*>(Heap::allocate(size));
+        for (size_t page = 0; touch && page < size; page += 4096) {
+            block[page] = 1;
+        }
+        blocks[slot] = block;
+    }
+    for (size_t i = 0; i < slots; i++) {
+        Heap::release(blocks[i]);
+    }
+}
+
+template <typename Heap>
+static void churn(size_t ops, uint64_t seed) {
+    replaceBlocks<Heap>(ops, 8192, 16, 256, false, seed);
+}
+
+template <typename Heap>
+static void large(size_t ops, uint64_t seed) {
+    replaceBlocks<Heap>(ops, 16, 64 << 10, 1 << 20, true, seed);
+}
+
+template <typename Heap>
+static void stl(size_t ops, uint64_t seed) {
+    typedef std::basic_string<char, std::char_traits<char>, HeapAllocator<char, Heap> > String;
+    typedef std::map<uint32_t, String, std::less<uint32_t>, HeapAllocator<std::pair<const uint32_t, String>, Heap> >
+        Map;
+    Map map;
+    std::vector<uint32_t, HeapAllocator<uint32_t, Heap> > keys;
+    Random random(seed);
+    for (size_t i = 0; i < ops; i++) {
+        uint32_t key = random.next() % 4096;
+        typename Map::iterator it = map.find(key);
+        if (it != map.end()) {
+            map.erase(it);
+        } else {
+            // Longer than the small-string buffer, so the string allocates.
+            map.insert(std::make_pair(key, String(24 + key % 40, 'x')));
+        }
+        keys.push_back(key);
+        if (keys.size() == 1024) {
+            std::vector<uint32_t, HeapAllocator<uint32_t, Heap> >().swap(keys);
+        }
+    }
+}
+
+// Single-producer, single-consumer ring; a thread that finds it full or
+// empty yields, so pairs also make progress on fewer cores than threads.
+class BlockRing {
+private:
+    static const size_t CAPACITY = 1024;
+    
+    void* slots[CAPACITY];
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+
+public:
+    BlockRing() : head(0), tail(0) {}
+    
+    void push(void* block) {
+        size_t position = tail.load(std::memory_order_relaxed);
+        while (position - head.load(std::memory_order_acquire) == CAPACITY) {
+            std::this_thread::yield();
+        }
+        slots[position % CAPACITY] = block;
+        tail.store(position + 1, std::memory_order_release);
+    }
+    
+    void* pop() {
+        size_t position = head.load(std::memory_order_relaxed);
+        while (tail.load(std::memory_order_acquire) == position) {
+            std::this_thread::yield();
+        }
+        void* block = slots[position % CAPACITY];
+        head.store(position + 1, std::memory_order_release);
+        return block;
+    }
+};
+
+template <typename Heap>
+static void produce(BlockRing* ring, size_t ops, uint64_t seed) {
+    Random random(seed);
+    for (size_t i = 0; i < ops; i++) {
+        ring->push(Heap::allocate(16 + random.next() % 241));
+    }
+}
+
+template <typename Heap>
+static void consume(BlockRing* ring, size_t ops) {
+    for (size_t i = 0; i < ops; i++) {
+        Heap::release(ring->pop());
+    }
+}
+
+enum Workload { CHURN, LARGE, CROSS, STL, WORKLOADS };
+static const char* const WORKLOAD_NAMES[WORKLOADS] = {"churn", "large", "cross", "stl"};
+
+// Large blocks cost far more per operation; they get fewer.
+static size_t workloadOps(Workload workload, size_t ops) {
+    return workload == LARGE ? ops / 16 : ops;
+}
+
+template <typename Heap>
+static void runThreads(Workload workload, size_t ops, int threads) {
+    std::vector<std::thread> pool;
+    std::vector<BlockRing> rings(workload == CROSS ? threads : 0);
+    for (int t = 0; t < threads; t++) {
+        uint64_t seed = static_cast<uint64_t>(t) + 1;
+        switch (workload) {
+            case CHURN: pool.push_back(std::thread(churn<Heap>, ops, seed)); break;
+            case LARGE: pool.push_back(std::thread(large<Heap>, ops, seed)); break;
+            case STL: pool.push_back(std::thread(stl<Heap>, ops, seed)); break;
+            default:
+                pool.push_back(std::thread(produce<Heap>, &rings[t], ops, seed));
+                pool.push_back(std::thread(consume<Heap>, &rings[t], ops));
+                break;
+        }
+    }
+    for (size_t i = 0; i < pool.size(); i++) {
+        pool[i].join();
+    }
+}
+
+struct Measurement {
+    double nanosPerOp;
+    long peakRssKb;
+};
+
+// Runs one warm-up pass and one timed pass in a child process and returns
+// its time per operation and per thread, and its peak RSS.
+template <typename Heap>
+static bool measure(Workload workload, size_t ops, int threads, Measurement& result) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return false;
+    }
+    fflush(stdout);
+    pid_t child = fork();
+    if (child < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (child == 0) {
+        close(fds[0]);
+        ops = workloadOps(workload, ops);
+        runThreads<Heap>(workload, ops / 10, threads);
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        runThreads<Heap>(workload, ops, threads);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        Measurement measured = {seconds * 1e9 / ops, usage.ru_maxrss};
+        ssize_t written = write(fds[1], &measured, sizeof(measured));
+        // Skips the profiler's exit handlers; only the numbers matter here.
+        _exit(written == static_cast<ssize_t>(sizeof(measured)) ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t received = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    int status = 0;
+    waitpid(child, &status, 0);
+    return received == static_cast<ssize_t>(sizeof(result)) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+template <typename Heap>
+static bool measureBest(Workload workload, size_t ops, int threads, int repeat, Measurement& best) {
+    for (int i = 0; i < repeat; i++) {
+        Measurement run;
+        if (!measure<Heap>(workload, ops, threads, run)) {
+            return false;
+        }
+        if (i == 0 || run.nanosPerOp < best.nanosPerOp) {
+            best.nanosPerOp = run.nanosPerOp;
+        }
+        if (i == 0 || run.peakRssKb < best.peakRssKb) {
+            best.peakRssKb = run.peakRssKb;
+        }
+    }
+    return true;
+}
+
+struct Result {
+    std::string workload;
+    int threads;
+    Measurement raw;
+    Measurement tracked;
+    
+    double ratio() const { return tracked.nanosPerOp / raw.nanosPerOp; }
+    long extraRssKb() const { return tracked.peakRssKb - raw.peakRssKb; }
+};
+
+static bool writeJson(const std::string& path, const std::vector<Result>& results, size_t ops) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "{\"format\":\"memprof-bench-1\",\"ops\":%zu,\"results\":[", ops);
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        fprintf(file,
+                "%s\n{\"workload\":\"%s\",\"threads\":%d,\"malloc_ns\":%.1f,\"tracked_ns\":%.1f,\"ratio\":%.3f,"
+                "\"malloc_rss_kb\":%ld,\"tracked_rss_kb\":%ld}",
+                i ? "," : "", r.workload.c_str(), r.threads, r.raw.nanosPerOp, r.tracked.nanosPerOp, r.ratio(),
+                r.raw.peakRssKb, r.tracked.peakRssKb);
+    }
+    fprintf(file, "]}\n");
+    return fclose(file) == 0;
+}
+
+// Reads a file written by writeJson, one result per line.
+static bool readJson(const std::string& path, std::vector<Result>& results) {
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file) {
+        return false;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        char workload[32];
+        Result r;
+        if (sscanf(line,
+                   "{\"workload\":\"%31[^\"]\",\"threads\":%d,\"malloc_ns\":%lf,\"tracked_ns\":%lf,\"ratio\":%*f,"
+                   "\"malloc_rss_kb\":%ld,\"tracked_rss_kb\":%ld}",
+                   workload, &r.threads, &r.raw.nanosPerOp, &r.tracked.nanosPerOp, &r.raw.peakRssKb,
+                   &r.tracked.peakRssKb) == 6) {
+            r.workload = workload;
+            results.push_back(r);
+        }
+    }
+    fclose(file);
+    return !results.empty();
+}
+
+// Extra RSS below this is noise from page and arena rounding.
+static const long RSS_SLACK_KB = 1024;
+
+static int compare(const std::vector<Result>& results, const std::vector<Result>& baseline, double threshold) {
+    int regressions = 0;
+    printf("\n%-8s %8s %14s %14s %16s %16s\n", "workload", "threads", "base ratio", "ratio", "base extra RSS",
+           "extra RSS");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        const Result* base = NULL;
+        for (size_t j = 0; j < baseline.size() && !base; j++) {
+            if (baseline[j].workload == r.workload && baseline[j].threads == r.threads) {
+                base = &baseline[j];
+            }
+        }
+        if (!base) {
+            printf("%-8s %8d %14s %13.2fx %16s %13ld KB  no baseline\n", r.workload.c_str(), r.threads, "-",
+                   r.ratio(), "-", r.extraRssKb());
+            continue;
+        }
+        bool slower = r.ratio() > base->ratio() * (1 + threshold);
+        bool bigger = r.extraRssKb() > base->extraRssKb() * (1 + threshold) + RSS_SLACK_KB;
+        printf("%-8s %8d %13.2fx %13.2fx %13ld KB %13ld KB  %s\n", r.workload.c_str(), r.threads, base->ratio(),
+               r.ratio(), base->extraRssKb(), r.extraRssKb(),
+               slower && bigger ? "REGRESSED (time, RSS)" : slower ? "REGRESSED (time)" : bigger ? "REGRESSED (RSS)"
+                                                                                                : "ok");
+        if (slower || bigger) {
+            regressions++;
+        }
+    }
+    return regressions;
+}
+
+// Powers of two, then N itself when it is not one.
+static int nextThreadCount(int threads, int maxThreads) {
+    if (threads < maxThreads && threads * 2 > maxThreads) {
+        return maxThreads;
+    }
+    return threads * 2;
+}
+
+int main(int argc, char** argv) {
+    size_t ops = 200000;
+    int maxThreads = static_cast<int>(std::thread::hardware_concurrency());
+    int repeat = 3;
+    double threshold = 0.25;
+    std::string jsonPath;
+    std::string baselinePath;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--ops" && i + 1 < argc) {
+            ops = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            maxThreads = atoi(argv[++i]);
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (arg == "--baseline" && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (arg == "--threshold" && i + 1 < argc) {
+            threshold = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--ops n] [--threads n] [--repeat n] [--json file] [--baseline file] "
+                            "[--threshold fraction]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (maxThreads < 1) {
+        maxThreads = 1;
+    }
+    if (repeat < 1) {
+        repeat = 1;
+    }
+    ops = ops < 6400 ? 6400 : ops;
+    
+    std::vector<Result> results;
+    printf("%-8s %8s %12s %12s %10s %14s %14s\n", "workload", "threads", "malloc ns", "tracked ns", "ratio",
+           "malloc RSS", "tracked RSS");
+    for (int w = 0; w < WORKLOADS; w++) {
+        for (int threads = 1; threads <= maxThreads; threads = nextThreadCount(threads, maxThreads)) {
+            Result r;
+            r.workload = WORKLOAD_NAMES[w];
+            r.threads = threads;
+            if (!measureBest<RawHeap>(static_cast<Workload>(w), ops, threads, repeat, r.raw) ||
+                !measureBest<TrackedHeap>(static_cast<Workload>(w), ops, threads, repeat, r.tracked)) {
+                fprintf(stderr, "[ERROR] %s with %d threads failed\n", r.workload.c_str(), threads);
+                return 1;
+            }
+            printf("%-8s %8d %12.1f %12.1f %9.2fx %11ld KB %11ld KB\n", r.workload.c_str(), threads,
+                   r.raw.nanosPerOp, r.tracked.nanosPerOp, r.ratio(), r.raw.peakRssKb, r.tracked.peakRssKb);
+            results.push_back(r);
+        }
+    }
+    
+    if (!jsonPath.empty() && !writeJson(jsonPath, results, ops)) {
+        fprintf(stderr, "[ERROR] Cannot write %s\n", jsonPath.c_str());
+        return 1;
+    }
+    if (!baselinePath.empty()) {
+        std::vector<Result> baseline;
+        if (!readJson(baselinePath, baseline)) {
+            fprintf(stderr, "[ERROR] Cannot read baseline %s\n", baselinePath.c_str());
+            return 1;
+        }
+        int regressions = compare(results, baseline, threshold);
+        if (regressions > 0) {
+            printf("\n%d result(s) regressed by more than %.0f%%\n", regressions, threshold * 100);
+            return 1;
+        }
+        printf("\nNo regressions beyond %.0f%%\n", threshold * 100);
+    }
+    return 0;
+}
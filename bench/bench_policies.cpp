@@ -0,0 +1,91 @@
+// Cost of each compile-time profiler policy per allocation and free,
+// against malloc and free alone.
+//
+// Build: g++ -std=c++17 -O2 -pthread -I.. bench_policies.cpp -o bench_policies -ldl
+// Usage: ./bench_policies [ops]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#define MEMPROF_NO_GLOBAL_HOOKS
+#include "memory_profiler.h"
+
+struct CountsOnlyPolicy : DefaultProfilerPolicy {
+    static constexpr bool siteAggregation = false;
+    static constexpr bool timestamps = false;
+    static constexpr bool stackCapture = false;
+    static constexpr bool threadIds = false;
+    static constexpr bool leakTracking = false;
+};
+
+struct SitesOnlyPolicy : DefaultProfilerPolicy {
+    static constexpr bool timestamps = false;
+    static constexpr bool stackCapture = false;
+    static constexpr bool threadIds = false;
+    static constexpr bool leakTracking = false;
+};
+
+struct LeaksOnlyPolicy : DefaultProfilerPolicy {
+    static constexpr bool siteAggregation = false;
+    static constexpr bool timestamps = false;
+    static constexpr bool stackCapture = false;
+    static constexpr bool threadIds = false;
+};
+
+static const size_t BATCH = 64;
+
+static double timeMalloc(size_t ops) {
+    void* blocks[BATCH];
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (size_t done = 0; done < ops; done += BATCH) {
+        for (size_t i = 0; i < BATCH; i++) {
+            blocks[i] = malloc(16 + (i * 24) % 512);
+        }
+        for (size_t i = 0; i < BATCH; i++) {
+            free(blocks[i]);
+        }
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+template <typename Policy>
+static double timePolicy(size_t ops, uint32_t stackDepth) {
+    BasicMemoryProfiler<Policy>& profiler = BasicMemoryProfiler<Policy>::getInstance();
+    profiler.setStackDepth(stackDepth);
+    void* blocks[BATCH];
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (size_t done = 0; done < ops; done += BATCH) {
+        for (size_t i = 0; i < BATCH; i++) {
+            size_t size = 16 + (i * 24) % 512;
+            blocks[i] = malloc(size);
+            profiler.recordAllocation(blocks[i], size, __FILE__, __LINE__);
+        }
+        for (size_t i = 0; i < BATCH; i++) {
+            profiler.recordDeallocation(blocks[i]);
+            free(blocks[i]);
+        }
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static void print(const char* name, double seconds, double baseline, size_t ops) {
+    printf("%-26s %12.1f %12.1f %10.2fx\n", name, seconds * 1e9 / ops, (seconds - baseline) * 1e9 / ops,
+           seconds / baseline);
+}
+
+int main(int argc, char** argv) {
+    size_t ops = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000000;
+    
+    // One warm-up pass so every configuration sees a primed malloc.
+    timeMalloc(ops);
+    double baseline = timeMalloc(ops);
+    printf("%-26s %12s %12s %11s\n", "policy", "ns/op", "overhead", "vs malloc");
+    print("malloc/free", baseline, baseline, ops);
+    print("disabled", timePolicy<DisabledProfilerPolicy>(ops, 0), baseline, ops);
+    print("counts only", timePolicy<CountsOnlyPolicy>(ops, 0), baseline, ops);
+    print("sites only", timePolicy<SitesOnlyPolicy>(ops, 0), baseline, ops);
+    print("leaks only", timePolicy<LeaksOnlyPolicy>(ops, 0), baseline, ops);
+    print("default", timePolicy<DefaultProfilerPolicy>(ops, 0), baseline, ops);
+    print("default, 8-frame stacks", timePolicy<DefaultProfilerPolicy>(ops, 8), baseline, ops);
+    return 0;
+}
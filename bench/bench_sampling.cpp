@@ -0,0 +1,74 @@
+// Per-operation overhead of MemoryProfiler at different sampling intervals,
+// against plain malloc/free, with the estimated totals it reports.
+//
+// Build: g++ -std=c++17 -O2 -pthread -I.. bench_sampling.cpp -o bench_sampling
+// Usage: ./bench_sampling [operations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#define MEMPROF_NO_GLOBAL_HOOKS
+#include "memory_profiler.h"
+
+static const size_t LIVE_BLOCKS = 4096;
+
+static size_t blockSize(size_t i) {
+    // Mostly small objects with an occasional large buffer.
+    return (i % 64) == 0 ? 16384 : 16 + (i * 40) % 496;
+}
+
+static double run(size_t ops, bool profiled, size_t& bytesAllocated) {
+    MemoryProfiler& profiler = MemoryProfiler::getInstance();
+    std::vector<void*> blocks(LIVE_BLOCKS, static_cast<void*>(NULL));
+    bytesAllocated = 0;
+    
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        size_t slot = (i * 2654435761u) % LIVE_BLOCKS;
+        if (blocks[slot]) {
+            if (profiled) {
+                profiler.recordDeallocation(blocks[slot]);
+            }
+            free(blocks[slot]);
+        }
+        size_t size = blockSize(i);
+        blocks[slot] = malloc(size);
+        bytesAllocated += size;
+        if (profiled) {
+            profiler.recordAllocation(blocks[slot], size, __FILE__, __LINE__);
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() / ops;
+    
+    for (size_t i = 0; i < LIVE_BLOCKS; i++) {
+        if (blocks[i]) {
+            if (profiled) {
+                profiler.recordDeallocation(blocks[i]);
+            }
+            free(blocks[i]);
+        }
+    }
+    return ns;
+}
+
+int main(int argc, char** argv) {
+    size_t ops = argc > 1 ? strtoul(argv[1], NULL, 10) : 5000000;
+    const size_t intervals[] = {0, 4096, 65536, 524288, 4194304};
+    MemoryProfiler& profiler = MemoryProfiler::getInstance();
+    
+    size_t bytes = 0;
+    double baseline = run(ops, false, bytes);
+    printf("%-12s %10s %12s %16s %16s\n", "interval", "ns/op", "overhead ns", "est. allocs", "actual allocs");
+    printf("%-12s %10.1f %12s %16s %16zu\n", "malloc only", baseline, "-", "-", ops);
+    
+    for (size_t i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++) {
+        profiler.reset();
+        profiler.setSamplingInterval(intervals[i]);
+        double ns = run(ops, true, bytes);
+        char label[32];
+        snprintf(label, sizeof(label), intervals[i] == 0 ? "every alloc" : "%zu B", intervals[i]);
+        printf("%-12s %10.1f %12.1f %16zu %16zu\n", label, ns, ns - baseline, profiler.totalAllocations(), ops);
+    }
+    return 0;
+}
@@ -1,172 +1,733 @@
-include <iostream>
-#include <fstream>
-#include <string>
-#include <cstdlib>
-#include"memory_profiler.h"
-
-void displayBanner() {
-    std::cout << "\n";
-    std::cout << "============================================================\n";
-    std::cout << "                                                            \n";
-    std::cout << "       C++ MEMORY PROFILER & LEAK DETECTOR                 \n";
-    std::cout << "                                                            \n";
-    std::cout << "          Analyze Memory Usage & Find Leaks                \n";
-    std::cout << "                                                            \n";
-    std::cout << "============================================================\n";
-    std::cout << "\n";
-}
-
-bool fileExists(const std::string& filename) {
-    std::ifstream file(filename.c_str());
-    return file.good();
-}
-
-std::string getFileExtension(const std::string& filename) {
-    size_t dotPos = filename.find_last_of(".");
-    if (dotPos != std::string::npos) {
-        return filename.substr(dotPos);
-    }
-    return "";
-}
-
-int main() {
-    displayBanner();
-    
-    std::string filename;
-    std::cout << "[*] Enter the C++ file to analyze: ";
-    std::getline(std::cin, filename);
-    
-    // Trim whitespace
-    size_t start = filename.find_first_not_of(" \t\n\r");
-    size_t end = filename.find_last_not_of(" \t\n\r");
-    if (start != std::string::npos && end != std::string::npos) {
-        filename = filename.substr(start, end - start + 1);
-    }
-    
-    // Check if file exists
-    if (!fileExists(filename)) {
-        std::cout << "\n[ERROR] File '" << filename << "' not found!\n";
-        std::cout << "        Please check the filename and try again.\n\n";
-        return 1;
-    }
-    
-    // Check file extension
-    std::string ext = getFileExtension(filename);
-    if (ext != ".cpp" && ext != ".cc" && ext != ".cxx" && ext != ".c++") {
-        std::cout << "\n[WARNING] File doesn't have a C++ extension (.cpp, .cc, .cxx)\n";
-        std::cout << "          Proceeding anyway...\n\n";
-    }
-    
-    std::cout << "\n[OK] File found: " << filename << "\n";
-    std::cout << "\n[*] Instrumenting code with memory profiler...\n";
-    
-    // Create instrumented version
-    std::string instrumentedFile = "instrumented_" + filename;
-    std::ifstream inFile(filename.c_str());
-    std::ofstream outFile(instrumentedFile.c_str());
-    
-    // Add profiler header at the beginning
-    outFile << "#include \"memory_profiler.h\"\n";
-    
-    // Copy original file content
-    std::string line;
-    bool hasMain = false;
-    std::vector<std::string> fileContent;
-    
-    while (std::getline(inFile, line)) {
-        // Check if this file already has the profiler
-        if (line.find("#include \"memory_profiler.h\"") != std::string::npos) {
-            std::cout << "\nWarning: File already includes memory_profiler.h\n";
-            std::cout << "   Using file as-is...\n";
-            inFile.close();
-            outFile.close();
-            remove(instrumentedFile.c_str());
-            instrumentedFile = filename;
-            hasMain = true;
-            break;
-        }
-        
-        if (line.find("int main") != std::string::npos) {
-            hasMain = true;
-        }
-        
-        fileContent.push_back(line);
-    }
-    
-    if (instrumentedFile != filename) {
-        // Write all content except the last closing brace of main
-        bool inMain = false;
-        int braceCount = 0;
-        
-        for (size_t i = 0; i < fileContent.size(); i++) {
-            std::string& currentLine = fileContent[i];
-            
-            if (currentLine.find("int main") != std::string::npos) {
-                inMain = true;
-            }
-            
-            // Count braces when in main
-            if (inMain) {
-                for (size_t j = 0; j < currentLine.length(); j++) {
-                    if (currentLine[j] == '{') braceCount++;
-                    if (currentLine[j] == '}') braceCount--;
-                }
-            }
-            
-            // If we're at the final return statement in main, add profiler code before it
-            if (inMain && braceCount == 1 && currentLine.find("return") != std::string::npos) {
-                outFile << "    // Memory Profiler Report Generation\n";
-                outFile << "    MemoryProfiler::getInstance().detectLeaks();\n";
-                outFile << "    MemoryProfiler::getInstance().printSummary();\n";
-                outFile << "    MemoryProfiler::getInstance().generateHTMLReport();\n";
-                outFile << "    \n";
-            }
-            
-            outFile << currentLine << "\n";
-        }
-        
-        inFile.close();
-        outFile.close();
-    }
-    
-    if (!hasMain) {
-        std::cout << "\n  Warning: No main() function found in the file.\n";
-        std::cout << "   The profiler needs a main() function to generate reports.\n\n";
-        return 1;
-    }
-    
-    // Compile the instrumented file
-    std::cout << "\n Compiling instrumented code...\n";
-    std::string outputExe = "profiled_program";
-    std::string compileCmd = "g++ \"" + instrumentedFile + "\" -o " + outputExe;
-    
-    int compileResult = system(compileCmd.c_str());
-    
-    if (compileResult != 0) {
-        std::cout << "\n Compilation failed!\n";
-        std::cout << "   Please check the error messages above.\n\n";
-        return 1;
-    }
-    
-    std::cout << " Compilation successful!\n";
-    std::cout << "\n Running memory analysis...\n";
-    
-    // Run the program
-#ifdef _WIN32
-    system(outputExe.c_str());
-#else
-    system(("./" + outputExe).c_str());
-#endif
-    std::cout << "\n Analysis Complete!\n";
-    std::cout << "\n To view the detailed report, run:\n";
-    std::cout << "   start memory_report.html    (Windows)\n";
-    std::cout << "   open memory_report.html     (macOS)\n";
-    std::cout << "   xdg-open memory_report.html (Linux)\n\n";
-    
-    // Clean up instrumented file if it was created
-    if (instrumentedFile != filename) {
-        remove(instrumentedFile.c_str());
-    }
-    
-    return 0;
-}
+// Builds a program with the memory profiler linked in. Sources are never
+// rewritten: every translation unit is compiled with -include
+// memory_profiler.h, and one generated runtime unit defines the global
+// new/delete hooks and writes the report from an atexit handler, so any
+// exit through return or exit() produces it.
+//
+//     ./memory_profiler                              asks for one file, builds and runs it
+//     ./memory_profiler [options] a.cpp b.cpp ...    builds a list of sources
+//     ./memory_profiler [options] -p compile_commands.json
+//
+// Objects are cached in the build directory and only rebuilt when their
+// source, a header they include or their command line changes, and
+// translation units are compiled in parallel before a single link.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <filesystem>
+#include <cstdlib>
+#include <cstdint>
+#include"memory_profiler.h"
+
+namespace fs = std::filesystem;
+
+void displayBanner() {
+    std::cout << "\n";
+    std::cout << "============================================================\n";
+    std::cout << "                                                            \n";
+    std::cout << "       C++ MEMORY PROFILER & LEAK DETECTOR                 \n";
+    std::cout << "                                                            \n";
+    std::cout << "          Analyze Memory Usage & Find Leaks                \n";
+    std::cout << "                                                            \n";
+    std::cout << "============================================================\n";
+    std::cout << "\n";
+}
+
+bool fileExists(const std::string& filename) {
+    std::ifstream file(filename.c_str());
+    return file.good();
+}
+
+std::string getFileExtension(const std::string& filename) {
+    size_t dotPos = filename.find_last_of(".");
+    if (dotPos != std::string::npos) {
+        return filename.substr(dotPos);
+    }
+    return "";
+}
+
+std::string readFile(const fs::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    std::ostringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+// Writes only when the content changed, so the file's timestamp does not
+// invalidate objects built from it.
+void writeFileIfChanged(const fs::path& path, const std::string& content) {
+    if (fs::exists(path) && readFile(path) == content) {
+        return;
+    }
+    std::ofstream file(path, std::ios::binary);
+    file << content;
+}
+
+std::string shellQuote(const std::string& arg) {
+    std::string quoted = "'";
+    for (size_t i = 0; i < arg.size(); i++) {
+        if (arg[i] == '\'') {
+            quoted += "'\\''";
+        } else {
+            quoted += arg[i];
+        }
+    }
+    return quoted + "'";
+}
+
+// Splits a command line the way a POSIX shell would for plain words and
+// quoting; no expansion is done.
+std::vector<std::string> splitCommand(const std::string& command) {
+    std::vector<std::string> args;
+    std::string current;
+    bool inWord = false;
+    for (size_t i = 0; i < command.size(); i++) {
+        char c = command[i];
+        if (c == '\'') {
+            size_t end = command.find('\'', i + 1);
+            end = end == std::string::npos ? command.size() : end;
+            current += command.substr(i + 1, end - i - 1);
+            i = end;
+            inWord = true;
+        } else if (c == '"') {
+            for (i++; i < command.size() && command[i] != '"'; i++) {
+                if (command[i] == '\\' && i + 1 < command.size() &&
+                    (command[i + 1] == '"' || command[i + 1] == '\\' || command[i + 1] == '$')) {
+                    i++;
+                }
+                current += command[i];
+            }
+            inWord = true;
+        } else if (c == '\\' && i + 1 < command.size()) {
+            current += command[++i];
+            inWord = true;
+        } else if (c == ' ' || c == '\t' || c == '\n') {
+            if (inWord) {
+                args.push_back(current);
+                current.clear();
+                inWord = false;
+            }
+        } else {
+            current += c;
+            inWord = true;
+        }
+    }
+    if (inWord) {
+        args.push_back(current);
+    }
+    return args;
+}
+
+uint64_t hashString(const std::string& text) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < text.size(); i++) {
+        hash = (hash ^ static_cast<unsigned char>(text[i])) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+struct CompileJob {
+    fs::path source;
+    fs::path directory;
+    // Compiler and flags as the project builds the file, without its output.
+    std::vector<std::string> arguments;
+    // False for the runtime unit and for C sources, which cannot include
+    // the profiler header.
+    bool instrument;
+    fs::path object;
+    std::string command;
+};
+
+// Just enough JSON for compile_commands.json: an array of objects whose
+// values of interest are strings or arrays of strings.
+class CompileDatabaseParser {
+private:
+    const std::string& text;
+    size_t pos;
+    
+    void skipSpace() {
+        while (pos < text.size() && isspace(static_cast<unsigned char>(text[pos]))) {
+            pos++;
+        }
+    }
+    
+    bool consume(char c) {
+        skipSpace();
+        if (pos < text.size() && text[pos] == c) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+    
+    bool parseString(std::string& out) {
+        out.clear();
+        if (!consume('"')) {
+            return false;
+        }
+        while (pos < text.size() && text[pos] != '"') {
+            char c = text[pos++];
+            if (c == '\\' && pos < text.size()) {
+                char escaped = text[pos++];
+                switch (escaped) {
+                    case 'n': out += '\n'; break;
+                    case 't': out += '\t'; break;
+                    case 'r': out += '\r'; break;
+                    case 'b': out += '\b'; break;
+                    case 'f': out += '\f'; break;
+                    case 'u':
+                        // Paths and flags are ASCII; keep the low byte.
+                        out += static_cast<char>(strtol(text.substr(pos, 4).c_str(), NULL, 16) & 0x7f);
+                        pos += 4;
+                        break;
+                    default: out += escaped; break;
+                }
+            } else {
+                out += c;
+            }
+        }
+        return consume('"');
+    }
+    
+    bool parseStringArray(std::vector<std::string>& out) {
+        out.clear();
+        if (!consume('[')) {
+            return false;
+        }
+        if (consume(']')) {
+            return true;
+        }
+        do {
+            std::string item;
+            if (!parseString(item)) {
+                return false;
+            }
+            out.push_back(item);
+        } while (consume(','));
+        return consume(']');
+    }
+    
+    bool skipValue() {
+        skipSpace();
+        if (pos >= text.size()) {
+            return false;
+        }
+        std::string ignored;
+        if (text[pos] == '"') {
+            return parseString(ignored);
+        }
+        if (text[pos] == '[' || text[pos] == '{') {
+            char close = text[pos] == '[' ? ']' : '}';
+            pos++;
+            if (consume(close)) {
+                return true;
+            }
+            do {
+                if (close == '}' && !(parseString(ignored) && consume(':'))) {
+                    return false;
+                }
+                if (!skipValue()) {
+                    return false;
+                }
+            } while (consume(','));
+            return consume(close);
+        }
+        while (pos < text.size() && (isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '-' ||
+                                     text[pos] == '+' || text[pos] == '.')) {
+            pos++;
+        }
+        return true;
+    }
+    
+    bool parseEntry(CompileJob& job) {
+        std::string directory;
+        std::string file;
+        std::string command;
+        std::vector<std::string> arguments;
+        if (!consume('{')) {
+            return false;
+        }
+        if (!consume('}')) {
+            do {
+                std::string key;
+                if (!parseString(key) || !consume(':')) {
+                    return false;
+                }
+                bool ok;
+                if (key == "directory") {
+                    ok = parseString(directory);
+                } else if (key == "file") {
+                    ok = parseString(file);
+                } else if (key == "command") {
+                    ok = parseString(command);
+                } else if (key == "arguments") {
+                    ok = parseStringArray(arguments);
+                } else {
+                    ok = skipValue();
+                }
+                if (!ok) {
+                    return false;
+                }
+            } while (consume(','));
+            if (!consume('}')) {
+                return false;
+            }
+        }
+        if (arguments.empty()) {
+            arguments = splitCommand(command);
+        }
+        if (file.empty() || arguments.empty()) {
+            return false;
+        }
+        job.directory = directory.empty() ? fs::current_path() : fs::path(directory);
+        job.source = fs::absolute(job.directory / file).lexically_normal();
+        job.arguments = arguments;
+        std::string ext = getFileExtension(file);
+        job.instrument = ext != ".c" && ext != ".m";
+        return true;
+    }
+
+public:
+    explicit CompileDatabaseParser(const std::string& content) : text(content), pos(0) {}
+    
+    bool parse(std::vector<CompileJob>& jobs) {
+        if (!consume('[')) {
+            return false;
+        }
+        if (consume(']')) {
+            return true;
+        }
+        do {
+            CompileJob job;
+            if (!parseEntry(job)) {
+                return false;
+            }
+            jobs.push_back(job);
+        } while (consume(','));
+        return consume(']');
+    }
+};
+
+struct BuildOptions {
+    std::vector<std::string> sources;
+    std::string compileDatabase;
+    std::string output;
+    fs::path buildDir;
+    fs::path headerDir;
+    std::string compiler;
+    std::string cxxFlags;
+    std::string ldFlags;
+    unsigned jobs;
+    bool fileLines;
+    bool run;
+    
+    BuildOptions() : output("profiled_program"), buildDir(".memprof_build"), cxxFlags("-std=c++17 -O1 -g"),
+                     jobs(std::max(1u, std::thread::hardware_concurrency())), fileLines(false), run(false) {
+        const char* cxx = getenv("CXX");
+        compiler = cxx && *cxx ? cxx : "g++";
+    }
+};
+
+// The one translation unit with the global allocation hooks. Its static
+// object is constructed ahead of the program's own, so the atexit handler
+// it registers runs after their destructors and their frees are counted.
+const char* RUNTIME_SOURCE =
+    "// Generated by memory_profiler; rebuilt when this text changes.\n"
+    "#define MEMPROF_NO_NEW_MACRO\n"
+    "#include \"memory_profiler.h\"\n"
+    "\n"
+    "namespace {\n"
+    "\n"
+    "void writeMemoryReport() {\n"
+    "    MemoryProfiler& profiler = MemoryProfiler::getInstance();\n"
+    "    const char* path = getenv(\"MEMPROF_REPORT\");\n"
+    "    profiler.detectLeaks();\n"
+    "    profiler.printSummary();\n"
+    "    profiler.generateHTMLReport(path && *path ? path : \"memory_report.html\");\n"
+    "    const char* pprof = getenv(\"MEMPROF_PPROF\");\n"
+    "    if (pprof && *pprof && !profiler.exportPprof(pprof)) {\n"
+    "        std::cerr << \"memprof: cannot write \" << pprof << \"\\n\";\n"
+    "    }\n"
+    "    const char* json = getenv(\"MEMPROF_JSON\");\n"
+    "    if (json && *json && !profiler.exportJson(json)) {\n"
+    "        std::cerr << \"memprof: cannot write \" << json << \"\\n\";\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "struct ReportAtExit {\n"
+    "    ReportAtExit() {\n"
+    "        const char* depth = getenv(\"MEMPROF_STACK_DEPTH\");\n"
+    "        if (depth && *depth) {\n"
+    "            MemoryProfiler::getInstance().setStackDepth(static_cast<uint32_t>(atoi(depth)));\n"
+    "        }\n"
+    "        atexit(writeMemoryReport);\n"
+    "    }\n"
+    "};\n"
+    "\n"
+    "ReportAtExit reportAtExit __attribute__((init_priority(101)));\n"
+    "\n"
+    "}\n";
+
+// Directory holding memory_profiler.h: next to this executable, or else
+// the current directory.
+fs::path findHeaderDir(const char* argv0) {
+    std::error_code error;
+    fs::path self = fs::canonical("/proc/self/exe", error);
+    if (error) {
+        self = fs::absolute(argv0, error);
+    }
+    if (!error && fs::exists(self.parent_path() / "memory_profiler.h")) {
+        return self.parent_path();
+    }
+    return fs::current_path();
+}
+
+// Drops what the build itself decides: compiling only, the output file and
+// dependency files.
+std::vector<std::string> withoutOutputFlags(const std::vector<std::string>& arguments) {
+    std::vector<std::string> kept;
+    for (size_t i = 0; i < arguments.size(); i++) {
+        const std::string& arg = arguments[i];
+        if (arg == "-o" || arg == "-MF" || arg == "-MT" || arg == "-MQ") {
+            i++;
+        } else if (arg == "-c" || arg == "-MD" || arg == "-MMD" ||
+                   (arg.size() > 2 && arg.compare(0, 2, "-o") == 0)) {
+            continue;
+        } else {
+            kept.push_back(arg);
+        }
+    }
+    return kept;
+}
+
+// Flag that stops the compiler from removing a new/delete pair whose
+// block is never used, which GCC and clang do from -O1, so the profiler
+// never sees it. A compiler that does not know GCC's flag
+// builds instrumented units at -O0 instead.
+std::string keepAllocationsFlag(const std::string& compiler) {
+    static std::map<std::string, std::string> probed;
+    std::map<std::string, std::string>::iterator it = probed.find(compiler);
+    if (it != probed.end()) {
+        return it->second;
+    }
+    std::string probe = shellQuote(compiler) + " -fno-allocation-dce -x c++ -fsyntax-only /dev/null > /dev/null 2>&1";
+    std::string flag = system(probe.c_str()) == 0 ? "-fno-allocation-dce" : "-O0";
+    probed[compiler] = flag;
+    return flag;
+}
+
+void prepareJob(CompileJob& job, const BuildOptions& options) {
+    fs::path objects = options.buildDir / "objects";
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "-%016llx.o",
+             static_cast<unsigned long long>(hashString(job.source.string())));
+    job.object = objects / (job.source.stem().string() + suffix);
+    
+    std::string command = "cd " + shellQuote(job.directory.string()) + " &&";
+    std::vector<std::string> arguments = withoutOutputFlags(job.arguments);
+    for (size_t i = 0; i < arguments.size(); i++) {
+        command += " " + shellQuote(arguments[i]);
+    }
+    if (job.instrument) {
+        command += " -include " + shellQuote((options.headerDir / "memory_profiler.h").string());
+        command += " -DMEMPROF_NO_GLOBAL_HOOKS";
+        if (!arguments.empty()) {
+            command += " " + keepAllocationsFlag(arguments[0]);
+        }
+        if (!options.fileLines) {
+            command += " -DMEMPROF_NO_NEW_MACRO";
+        }
+    }
+    command += " -fno-omit-frame-pointer -c -MMD -MF " + shellQuote(job.object.string() + ".d");
+    command += " -o " + shellQuote(job.object.string());
+    job.command = command;
+}
+
+// Make's rule for one object: rebuild when it is missing, was built with
+// another command, or is older than any file the compiler read for it.
+bool isUpToDate(const CompileJob& job) {
+    std::error_code error;
+    fs::file_time_type built = fs::last_write_time(job.object, error);
+    if (error || readFile(job.object.string() + ".cmd") != job.command) {
+        return false;
+    }
+    std::string deps = readFile(job.object.string() + ".d");
+    size_t colon = deps.find(": ");
+    if (colon == std::string::npos) {
+        return false;
+    }
+    std::string path;
+    for (size_t i = colon + 1; i <= deps.size(); i++) {
+        char c = i < deps.size() ? deps[i] : '\n';
+        if (c == '\\' && i + 1 < deps.size() && deps[i + 1] != '\n' && deps[i + 1] != '\r') {
+            path += deps[++i];
+        } else if (c == ' ' || c == '\n' || c == '\r' || c == '\\' || c == '\t') {
+            if (!path.empty()) {
+                fs::file_time_type modified = fs::last_write_time(job.directory / path, error);
+                if (error || modified > built) {
+                    return false;
+                }
+                path.clear();
+            }
+        } else {
+            path += c;
+        }
+    }
+    return true;
+}
+
+// Compiles the out-of-date jobs on `workers` threads. The compiler's output
+// for each file is collected and printed in one piece.
+bool compileAll(std::vector<CompileJob*>& pending, unsigned workers) {
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    std::mutex outputMutex;
+    size_t finished = 0;
+    
+    auto work = [&]() {
+        for (size_t i = next++; i < pending.size() && !failed; i = next++) {
+            CompileJob& job = *pending[i];
+            std::string log = job.object.string() + ".log";
+            int status = system((job.command + " 2> " + shellQuote(log)).c_str());
+            std::string messages = readFile(log);
+            if (status == 0) {
+                std::ofstream(job.object.string() + ".cmd", std::ios::binary) << job.command;
+            } else {
+                failed = true;
+            }
+            
+            std::lock_guard<std::mutex> guard(outputMutex);
+            finished++;
+            std::cout << "  [" << finished << "/" << pending.size() << "] " << job.source.filename().string()
+                      << (status == 0 ? "" : " FAILED") << "\n";
+            std::cout << messages << std::flush;
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < workers && t < pending.size(); t++) {
+        threads.push_back(std::thread(work));
+    }
+    work();
+    for (size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+    return !failed;
+}
+
+bool buildProject(std::vector<CompileJob>& jobs, BuildOptions& options) {
+    std::error_code error;
+    options.buildDir = fs::absolute(options.buildDir);
+    fs::create_directories(options.buildDir / "objects", error);
+    if (error) {
+        std::cout << "\n[ERROR] Cannot create " << options.buildDir.string() << ": " << error.message() << "\n";
+        return false;
+    }
+    
+    fs::path runtime = options.buildDir / "memprof_runtime.cpp";
+    writeFileIfChanged(runtime, RUNTIME_SOURCE);
+    CompileJob runtimeJob;
+    runtimeJob.source = runtime;
+    runtimeJob.directory = options.buildDir;
+    runtimeJob.arguments.push_back(options.compiler);
+    runtimeJob.arguments.push_back("-std=c++17");
+    runtimeJob.arguments.push_back("-O2");
+    runtimeJob.arguments.push_back("-I" + options.headerDir.string());
+    runtimeJob.arguments.push_back(runtime.string());
+    runtimeJob.instrument = false;
+    jobs.push_back(runtimeJob);
+    
+    std::vector<CompileJob*> pending;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        prepareJob(jobs[i], options);
+        if (!isUpToDate(jobs[i])) {
+            pending.push_back(&jobs[i]);
+        }
+    }
+    std::cout << "\n Compiling " << pending.size() << " of " << jobs.size() << " translation units ("
+              << (jobs.size() - pending.size()) << " cached, " << options.jobs << " jobs)...\n" << std::flush;
+    if (!compileAll(pending, options.jobs)) {
+        std::cout << "\n Compilation failed!\n";
+        std::cout << "   Please check the error messages above.\n\n";
+        return false;
+    }
+    
+    fs::path output = fs::absolute(options.output);
+    std::string link = shellQuote(options.compiler);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        link += " " + shellQuote(jobs[i].object.string());
+    }
+    link += " -o " + shellQuote(output.string()) + " -rdynamic -pthread -ldl";
+    if (!options.ldFlags.empty()) {
+        link += " " + options.ldFlags;
+    }
+    
+    // Nothing to link when no object is newer than the program.
+    fs::path linkStamp = options.buildDir / "link.cmd";
+    fs::file_time_type linked = fs::last_write_time(output, error);
+    bool relink = error || !pending.empty() || readFile(linkStamp) != link;
+    for (size_t i = 0; i < jobs.size() && !relink; i++) {
+        relink = fs::last_write_time(jobs[i].object, error) > linked || error;
+    }
+    if (relink) {
+        std::cout << " Linking " << output.filename().string() << "...\n" << std::flush;
+        if (system(link.c_str()) != 0) {
+            std::cout << "\n Link failed!\n\n";
+            return false;
+        }
+        std::ofstream(linkStamp, std::ios::binary) << link;
+    }
+    std::cout << " Build successful: " << output.string() << "\n";
+    return true;
+}
+
+void runProgram(const BuildOptions& options) {
+    std::cout << "\n Running memory analysis...\n" << std::flush;
+    system(shellQuote(fs::absolute(options.output).string()).c_str());
+    std::cout << "\n Analysis Complete!\n";
+    std::cout << "\n To view the detailed report, run:\n";
+    std::cout << "   start memory_report.html    (Windows)\n";
+    std::cout << "   open memory_report.html     (macOS)\n";
+    std::cout << "   xdg-open memory_report.html (Linux)\n\n";
+}
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [options] source.cpp...\n";
+    std::cout << "       " << program << " [options] -p compile_commands.json\n\n";
+    std::cout << "  -o FILE          program to build (default profiled_program)\n";
+    std::cout << "  -j N             compile N files at once (default: one per core)\n";
+    std::cout << "  --build-dir DIR  object cache (default .memprof_build)\n";
+    std::cout << "  --cxxflags FLAGS flags for a source list (default \"-std=c++17 -O1 -g\")\n";
+    std::cout << "  --ldflags FLAGS  extra link flags, such as the project's libraries\n";
+    std::cout << "  --file-lines     define the `new` macro so sites carry file and line;\n";
+    std::cout << "                   breaks code that declares operator new or uses placement new\n";
+    std::cout << "  --run            run the program after building it\n\n";
+    std::cout << "Instrumented sources must build as C++17. The program writes memory_report.html\n";
+    std::cout << "(or $MEMPROF_REPORT) when it exits; MEMPROF_STACK_DEPTH groups sites by stack.\n";
+}
+
+bool parseArguments(int argc, char** argv, BuildOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-p" && hasValue) {
+            options.compileDatabase = argv[++i];
+        } else if (arg == "-o" && hasValue) {
+            options.output = argv[++i];
+        } else if (arg == "-j" && hasValue) {
+            options.jobs = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--build-dir" && hasValue) {
+            options.buildDir = argv[++i];
+        } else if (arg == "--cxxflags" && hasValue) {
+            options.cxxFlags = argv[++i];
+        } else if (arg == "--ldflags" && hasValue) {
+            options.ldFlags = argv[++i];
+        } else if (arg == "--file-lines") {
+            options.fileLines = true;
+        } else if (arg == "--run") {
+            options.run = true;
+        } else if (!arg.empty() && arg[0] == '-') {
+            return false;
+        } else {
+            options.sources.push_back(arg);
+        }
+    }
+    return options.compileDatabase.empty() != options.sources.empty();
+}
+
+bool loadJobs(const BuildOptions& options, std::vector<CompileJob>& jobs) {
+    if (!options.compileDatabase.empty()) {
+        if (!fileExists(options.compileDatabase)) {
+            std::cout << "\n[ERROR] File '" << options.compileDatabase << "' not found!\n\n";
+            return false;
+        }
+        std::string content = readFile(options.compileDatabase);
+        CompileDatabaseParser parser(content);
+        if (!parser.parse(jobs) || jobs.empty()) {
+            std::cout << "\n[ERROR] " << options.compileDatabase << " is not a valid compilation database\n\n";
+            return false;
+        }
+        return true;
+    }
+    
+    std::vector<std::string> flags = splitCommand(options.cxxFlags);
+    for (size_t i = 0; i < options.sources.size(); i++) {
+        if (!fileExists(options.sources[i])) {
+            std::cout << "\n[ERROR] File '" << options.sources[i] << "' not found!\n\n";
+            return false;
+        }
+        CompileJob job;
+        job.source = fs::absolute(options.sources[i]).lexically_normal();
+        job.directory = fs::current_path();
+        job.arguments.push_back(options.compiler);
+        job.arguments.insert(job.arguments.end(), flags.begin(), flags.end());
+        job.arguments.push_back(job.source.string());
+        job.instrument = true;
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    displayBanner();
+    
+    BuildOptions options;
+    options.headerDir = findHeaderDir(argv[0]);
+    if (argc > 1) {
+        if (!parseArguments(argc, argv, options)) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        std::vector<CompileJob> jobs;
+        if (!loadJobs(options, jobs) || !buildProject(jobs, options)) {
+            return 1;
+        }
+        if (options.run) {
+            runProgram(options);
+        }
+        return 0;
+    }
+    
+    std::string filename;
+    std::cout << "[*] Enter the C++ file to analyze: ";
+    std::getline(std::cin, filename);
+    
+    // Trim whitespace
+    size_t start = filename.find_first_not_of(" \t\n\r");
+    size_t end = filename.find_last_not_of(" \t\n\r");
+    if (start != std::string::npos && end != std::string::npos) {
+        filename = filename.substr(start, end - start + 1);
+    }
+    
+    // Check if file exists
+    if (!fileExists(filename)) {
+        std::cout << "\n[ERROR] File '" << filename << "' not found!\n";
+        std::cout << "        Please check the filename and try again.\n\n";
+        return 1;
+    }
+    
+    // Check file extension
+    std::string ext = getFileExtension(filename);
+    if (ext != ".cpp" && ext != ".cc" && ext != ".cxx" && ext != ".c++") {
+        std::cout << "\n[WARNING] File doesn't have a C++ extension (.cpp, .cc, .cxx)\n";
+        std::cout << "          Proceeding anyway...\n\n";
+    }
+    
+    std::cout << "\n[OK] File found: " << filename << "\n";
+    
+    // A single file keeps the file and line of each `new` expression.
+    options.sources.push_back(filename);
+    options.fileLines = true;
+    std::vector<CompileJob> jobs;
+    if (!loadJobs(options, jobs) || !buildProject(jobs, options)) {
+        return 1;
+    }
+    runProgram(options);
+    return 0;
+}
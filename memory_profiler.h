@@ -1,312 +1,4483 @@
-
-#ifndef MEMORY_PROFILER_H
-#define MEMORY_PROFILER_H
-
-#include <iostream>
-#include <map>
-#include <vector>
-#include <string>
-#include <fstream>
-#include <sstream>
-#include <ctime>
-#include <cstring>
-#include <algorithm>
-
-struct AllocationInfo {
-    void* address;
-    size_t size;
-    std::string file;
-    int line;
-    std::string timestamp;
-    int threadId;
-    bool freed;
-    
-    AllocationInfo() : address(NULL), size(0), line(0), threadId(0), freed(false) {}
-};
-
-class MemoryProfiler {
-private:
-    std::map<void*, AllocationInfo> allocations;
-    
-    size_t totalAllocations;
-    size_t totalDeallocations;
-    size_t currentMemoryUsage;
-    size_t peakMemoryUsage;
-    
-    std::map<std::string, size_t> allocationSites;
-    std::vector<AllocationInfo> leakList;
-    
-    std::string getCurrentTimestamp() {
-        time_t now = time(0);
-        char buffer[100];
-        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", localtime(&now));
-        return std::string(buffer);
-    }
-    
-    MemoryProfiler() : totalAllocations(0), totalDeallocations(0), 
-                       currentMemoryUsage(0), peakMemoryUsage(0) {}
-    
-public:
-    static MemoryProfiler& getInstance() {
-        static MemoryProfiler instance;
-        return instance;
-    }
-    
-    void recordAllocation(void* ptr, size_t size, const char* file, int line) {
-        AllocationInfo info;
-        info.address = ptr;
-        info.size = size;
-        info.file = file ? file : "unknown";
-        info.line = line;
-        info.timestamp = getCurrentTimestamp();
-        info.threadId = 1;
-        info.freed = false;
-        
-        allocations[ptr] = info;
-        totalAllocations++;
-        currentMemoryUsage += size;
-        if (currentMemoryUsage > peakMemoryUsage) {
-            peakMemoryUsage = currentMemoryUsage;
-        }
-        
-        std::string site = std::string(file ? file : "unknown") + ":" + 
-                          static_cast<std::ostringstream&>(std::ostringstream() << line).str();
-        allocationSites[site]++;
-    }
-    
-    void recordDeallocation(void* ptr) {
-        std::map<void*, AllocationInfo>::iterator it = allocations.find(ptr);
-        if (it != allocations.end()) {
-            currentMemoryUsage -= it->second.size;
-            it->second.freed = true;
-            totalDeallocations++;
-        }
-    }
-    
-    void detectLeaks() {
-        leakList.clear();
-        
-        for (std::map<void*, AllocationInfo>::iterator it = allocations.begin(); 
-             it != allocations.end(); ++it) {
-            if (!it->second.freed) {
-                leakList.push_back(it->second);
-            }
-        }
-    }
-    
-    void generateHTMLReport(const std::string& filename = "memory_report.html") {
-        detectLeaks();
-        
-        std::ofstream file(filename.c_str());
-        
-        file << "<!DOCTYPE html>\n";
-        file << "<html lang=\"en\">\n";
-        file << "<head>\n";
-        file << "    <meta charset=\"UTF-8\">\n";
-        file << "    <meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">\n";
-        file << "    <title>Memory Profiler Report</title>\n";
-        file << "    <style>\n";
-        file << "        * { margin: 0; padding: 0; box-sizing: border-box; }\n";
-        file << "        body { font-family: 'Segoe UI', Tahoma, Geneva, Verdana, sans-serif;\n";
-        file << "               background: linear-gradient(135deg, #667eea 0%, #764ba2 100%);\n";
-        file << "               padding: 20px; min-height: 100vh; }\n";
-        file << "        .container { max-width: 1400px; margin: 0 auto; }\n";
-        file << "        .header { background: white; padding: 30px; border-radius: 15px;\n";
-        file << "                  box-shadow: 0 10px 30px rgba(0,0,0,0.2); margin-bottom: 20px; text-align: center; }\n";
-        file << "        .header h1 { color: #667eea; font-size: 2.5em; margin-bottom: 10px; }\n";
-        file << "        .header .subtitle { color: #666; font-size: 1.1em; }\n";
-        file << "        .stats-grid { display: grid; grid-template-columns: repeat(auto-fit, minmax(250px, 1fr));\n";
-        file << "                      gap: 20px; margin-bottom: 20px; }\n";
-        file << "        .stat-card { background: white; padding: 25px; border-radius: 15px;\n";
-        file << "                     box-shadow: 0 5px 15px rgba(0,0,0,0.1); transition: transform 0.3s; }\n";
-        file << "        .stat-card:hover { transform: translateY(-5px); box-shadow: 0 10px 25px rgba(0,0,0,0.2); }\n";
-        file << "        .stat-card .icon { font-size: 2em; margin-bottom: 10px; }\n";
-        file << "        .stat-card .label { color: #666; font-size: 0.9em; margin-bottom: 5px; }\n";
-        file << "        .stat-card .value { font-size: 2em; font-weight: bold; color: #333; }\n";
-        file << "        .leak-alert { background: #fff3cd; border-left: 5px solid #ffc107;\n";
-        file << "                      padding: 20px; border-radius: 10px; margin-bottom: 20px; }\n";
-        file << "        .leak-critical { background: #f8d7da; border-left: 5px solid #dc3545; }\n";
-        file << "        .section { background: white; padding: 30px; border-radius: 15px;\n";
-        file << "                   box-shadow: 0 5px 15px rgba(0,0,0,0.1); margin-bottom: 20px; }\n";
-        file << "        .section h2 { color: #667eea; margin-bottom: 20px; padding-bottom: 10px;\n";
-        file << "                      border-bottom: 3px solid #667eea; }\n";
-        file << "        table { width: 100%; border-collapse: collapse; margin-top: 15px; }\n";
-        file << "        th, td { padding: 12px; text-align: left; border-bottom: 1px solid #ddd; }\n";
-        file << "        th { background: #667eea; color: white; font-weight: 600; }\n";
-        file << "        tr:hover { background: #f5f5f5; }\n";
-        file << "        .progress-bar { width: 100%; height: 30px; background: #e0e0e0;\n";
-        file << "                        border-radius: 15px; overflow: hidden; margin: 10px 0; }\n";
-        file << "        .progress-fill { height: 100%; background: linear-gradient(90deg, #667eea, #764ba2);\n";
-        file << "                         display: flex; align-items: center; justify-content: center;\n";
-        file << "                         color: white; font-weight: bold; transition: width 0.3s; }\n";
-        file << "        .badge { display: inline-block; padding: 5px 10px; border-radius: 20px;\n";
-        file << "                 font-size: 0.85em; font-weight: 600; }\n";
-        file << "        .badge-danger { background: #dc3545; color: white; }\n";
-        file << "        .badge-warning { background: #ffc107; color: #333; }\n";
-        file << "        .badge-success { background: #28a745; color: white; }\n";
-        file << "    </style>\n";
-        file << "</head>\n";
-        file << "<body>\n";
-        file << "    <div class=\"container\">\n";
-        file << "        <div class=\"header\">\n";
-        file << "            <h1>🔍 Memory Profiler Report</h1>\n";
-        file << "            <p class=\"subtitle\">Comprehensive Memory Analysis & Leak Detection</p>\n";
-        file << "            <p class=\"subtitle\">Generated: " << getCurrentTimestamp() << "</p>\n";
-        file << "        </div>\n";
-        
-        // Statistics Cards
-        file << "        <div class=\"stats-grid\">\n";
-        file << "            <div class=\"stat-card\"><div class=\"icon\">📊</div>\n";
-        file << "                <div class=\"label\">Total Allocations</div>\n";
-        file << "                <div class=\"value\">" << totalAllocations << "</div></div>\n";
-        file << "            <div class=\"stat-card\"><div class=\"icon\">✅</div>\n";
-        file << "                <div class=\"label\">Total Deallocations</div>\n";
-        file << "                <div class=\"value\">" << totalDeallocations << "</div></div>\n";
-        file << "            <div class=\"stat-card\"><div class=\"icon\">💾</div>\n";
-        file << "                <div class=\"label\">Current Usage</div>\n";
-        file << "                <div class=\"value\">" << (currentMemoryUsage / 1024.0) << " KB</div></div>\n";
-        file << "            <div class=\"stat-card\"><div class=\"icon\">📈</div>\n";
-        file << "                <div class=\"label\">Peak Usage</div>\n";
-        file << "                <div class=\"value\">" << (peakMemoryUsage / 1024.0) << " KB</div></div>\n";
-        file << "            <div class=\"stat-card\"><div class=\"icon\">⚠️</div>\n";
-        file << "                <div class=\"label\">Memory Leaks</div>\n";
-        file << "                <div class=\"value\">" << leakList.size() << "</div></div>\n";
-        file << "            <div class=\"stat-card\"><div class=\"icon\">🎯</div>\n";
-        file << "                <div class=\"label\">Active Allocations</div>\n";
-        file << "                <div class=\"value\">" << (totalAllocations - totalDeallocations) << "</div></div>\n";
-        file << "        </div>\n";
-        
-        // Leak Alert
-        if (!leakList.empty()) {
-            size_t leakedBytes = 0;
-            for (size_t i = 0; i < leakList.size(); i++) {
-                leakedBytes += leakList[i].size;
-            }
-            
-            std::string alertClass = leakedBytes > 10240 ? "leak-alert leak-critical" : "leak-alert";
-            file << "        <div class=\"" << alertClass << "\">\n";
-            file << "            <h3>⚠️ Memory Leak Detected!</h3>\n";
-            file << "            <p><strong>" << leakList.size() << "</strong> allocations were not freed, totaling <strong>" 
-                 << (leakedBytes / 1024.0) << " KB</strong> of leaked memory.</p>\n";
-            file << "        </div>\n";
-        } else {
-            file << "        <div class=\"leak-alert\" style=\"background: #d4edda; border-color: #28a745;\">\n";
-            file << "            <h3>✅ No Memory Leaks Detected!</h3>\n";
-            file << "            <p>All allocations have been properly freed.</p>\n";
-            file << "        </div>\n";
-        }
-        
-        // Memory Leaks Table
-        if (!leakList.empty()) {
-            file << "        <div class=\"section\">\n";
-            file << "            <h2>🔴 Detected Memory Leaks</h2>\n";
-            file << "            <table><thead><tr><th>Address</th><th>Size</th><th>Location</th>\n";
-            file << "                <th>Timestamp</th><th>Thread ID</th><th>Severity</th></tr></thead><tbody>\n";
-            
-            for (size_t i = 0; i < leakList.size(); i++) {
-                const AllocationInfo& leak = leakList[i];
-                std::string severity = leak.size > 1024 ? "Major" : "Minor";
-                std::string badgeClass = leak.size > 1024 ? "badge-danger" : "badge-warning";
-                
-                file << "                    <tr><td><code>" << leak.address << "</code></td>\n";
-                file << "                        <td>" << leak.size << " bytes</td>\n";
-                file << "                        <td>" << leak.file << ":" << leak.line << "</td>\n";
-                file << "                        <td>" << leak.timestamp << "</td><td>" << leak.threadId << "</td>\n";
-                file << "                        <td><span class=\"badge " << badgeClass << "\">" 
-                     << severity << "</span></td></tr>\n";
-            }
-            
-            file << "                </tbody></table></div>\n";
-        }
-        
-        // Allocation Sites
-        file << "        <div class=\"section\"><h2>📍 Top Allocation Sites</h2>\n";
-        file << "            <table><thead><tr><th>Location</th><th>Allocation Count</th>\n";
-        file << "                <th>Frequency</th></tr></thead><tbody>\n";
-        
-        std::vector<std::pair<std::string, size_t> > sortedSites(allocationSites.begin(), allocationSites.end());
-        
-        for (size_t i = 0; i < sortedSites.size(); i++) {
-            for (size_t j = 0; j < sortedSites.size() - 1 - i; j++) {
-                if (sortedSites[j].second < sortedSites[j + 1].second) {
-                    std::pair<std::string, size_t> temp = sortedSites[j];
-                    sortedSites[j] = sortedSites[j + 1];
-                    sortedSites[j + 1] = temp;
-                }
-            }
-        }
-        
-        size_t displayCount = sortedSites.size() < 10 ? sortedSites.size() : 10;
-        for (size_t i = 0; i < displayCount; i++) {
-            double percentage = (sortedSites[i].second * 100.0) / totalAllocations;
-            file << "                    <tr><td><code>" << sortedSites[i].first << "</code></td>\n";
-            file << "                        <td>" << sortedSites[i].second << "</td><td>\n";
-            file << "                            <div class=\"progress-bar\" style=\"height: 20px;\">\n";
-            file << "                                <div class=\"progress-fill\" style=\"width: " 
-                 << percentage << "%; font-size: 0.8em;\">" << percentage << "%</div></div></td></tr>\n";
-        }
-        
-        file << "                </tbody></table></div>\n";
-        
-        file << "        <div class=\"section\"><h2>💡 Optimization Tips</h2>\n";
-        file << "            <ul style=\"line-height: 2;\">\n";
-        file << "                <li>✓ Review allocation sites with high frequency for optimization opportunities</li>\n";
-        file << "                <li>✓ Consider using object pools for frequently allocated/deallocated objects</li>\n";
-        file << "                <li>✓ Use smart pointers to prevent leaks</li>\n";
-        file << "                <li>✓ Profile your application regularly during development</li>\n";
-        file << "                <li>✓ Enable compiler warnings for memory-related issues</li>\n";
-        file << "            </ul></div></div></body></html>\n";
-        
-        file.close();
-        std::cout << "\n HTML report generated: " << filename << std::endl;
-        std::cout << "Open it with: start " << filename << "\n\n";
-    }
-    
-    void printSummary() {
-        std::cout << "\n========================================\n";
-        std::cout << "    MEMORY PROFILER SUMMARY\n";
-        std::cout << "========================================\n\n";
-        std::cout << "Total Allocations:   " << totalAllocations << "\n";
-        std::cout << "Total Deallocations: " << totalDeallocations << "\n";
-        std::cout << "Current Usage:       " << (currentMemoryUsage / 1024.0) << " KB\n";
-        std::cout << "Peak Usage:          " << (peakMemoryUsage / 1024.0) << " KB\n";
-        std::cout << "Memory Leaks:        " << leakList.size() << "\n";
-        std::cout << "========================================\n\n";
-    }
-};
-
-// Override new/delete operators
-void* operator new(size_t size, const char* file, int line) {
-    void* ptr = malloc(size);
-    if (ptr) {
-        MemoryProfiler::getInstance().recordAllocation(ptr, size, file, line);
-    }
-    return ptr;
-}
-
-void* operator new[](size_t size, const char* file, int line) {
-    void* ptr = malloc(size);
-    if (ptr) {
-        MemoryProfiler::getInstance().recordAllocation(ptr, size, file, line);
-    }
-    return ptr;
-}
-
-void operator delete(void* ptr) throw() {
-    if (ptr) {
-        MemoryProfiler::getInstance().recordDeallocation(ptr);
-        free(ptr);
-    }
-}
-
-void operator delete[](void* ptr) throw() {
-    if (ptr) {
-        MemoryProfiler::getInstance().recordDeallocation(ptr);
-        free(ptr);
-    }
-}
-
-#define new new(__FILE__, __LINE__)
-
-#endif 
-
+#ifndef MEMORY_PROFILER_H
+#define MEMORY_PROFILER_H
+
+#include <iostream>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <ctime>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <new>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#endif
+
+#include "memprof_trace.h"
+#include "memprof_policy.h"
+#include "memprof_export.h"
+
+#ifdef MEMPROF_HAVE_LIBUNWIND
+#define UNW_LOCAL_ONLY
+#include <libunwind.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define MEMPROF_CALLER() _ReturnAddress()
+#define MEMPROF_NOINLINE __declspec(noinline)
+#else
+#define MEMPROF_CALLER() __builtin_return_address(0)
+#define MEMPROF_NOINLINE __attribute__((noinline))
+#endif
+
+// How a block was allocated, so the form used to free it can be checked.
+enum AllocationKind {
+    ALLOC_PLAIN = 0,
+    ALLOC_NEW = 1,
+    ALLOC_NEW_ARRAY = 2
+};
+
+// Fixed-size record kept for every live allocation. The call site and the
+// wall-clock time are resolved only when a report is written.
+struct AllocationInfo {
+    void* address;
+    size_t size;
+    uint64_t timestamp;
+    uint32_t siteId;
+    int threadId : 30;
+    unsigned kind : 2;
+};
+
+// Monotonic nanoseconds used for allocation timestamps.
+inline uint64_t monotonicNanos() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// OS-level id of the calling thread, cached after the first lookup.
+inline int currentThreadId() {
+    static thread_local int tid = 0;
+    if (tid == 0) {
+#if defined(_WIN32)
+        tid = static_cast<int>(GetCurrentThreadId());
+#elif defined(__linux__)
+        tid = static_cast<int>(syscall(SYS_gettid));
+#else
+        tid = static_cast<int>(std::hash<std::thread::id>()(std::this_thread::get_id()) & 0x7fffffff);
+#endif
+    }
+    return tid;
+}
+
+// Test-and-set lock for the short critical sections of a single shard.
+class SpinLock {
+private:
+    std::atomic_flag flag;
+    
+public:
+    SpinLock() { flag.clear(); }
+    
+    void lock() {
+        int spins = 0;
+        while (flag.test_and_set(std::memory_order_acquire)) {
+            if (++spins > 64) {
+                std::this_thread::yield();
+                spins = 0;
+            }
+        }
+    }
+    
+    bool tryLock() { return !flag.test_and_set(std::memory_order_acquire); }
+    
+    void unlock() { flag.clear(std::memory_order_release); }
+};
+
+// Private memory for the profiler's own tables. Memory is mapped straight
+// from the OS in chunks, so none of it comes from the heap being profiled.
+// Small blocks are carved from the current chunk and recycled through
+// power-of-two free lists; large blocks get a mapping of their own.
+// Callers pass the block size back on deallocate, so blocks carry no header.
+class ProfilerArena {
+private:
+    static const size_t CHUNK_SIZE = size_t(1) << 20;
+    static const size_t LARGE_THRESHOLD = CHUNK_SIZE / 4;
+    static const size_t MIN_CLASS_BITS = 4;
+    static const size_t CLASS_COUNT = 15;
+    static const size_t LARGE_HEADER = 64;
+    
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+    
+    struct Mapping {
+        Mapping* prev;
+        Mapping* next;
+        size_t bytes;
+    };
+    
+    SpinLock lock;
+    Mapping* mappings;
+    char* cursor;
+    char* limit;
+    FreeBlock* freeLists[CLASS_COUNT];
+    
+    // Written under the lock, read without it for statistics.
+    std::atomic<size_t> mappedBytes;
+    std::atomic<size_t> usedBytes;
+    std::atomic<size_t> peakUsedBytes;
+    size_t byteLimit;
+    
+    static size_t sizeClass(size_t size) {
+        size_t cls = 0;
+        while ((size_t(1) << (cls + MIN_CLASS_BITS)) < size) {
+            cls++;
+        }
+        return cls;
+    }
+    
+    static void* mapPages(size_t bytes) {
+#ifdef _WIN32
+        return VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+        void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return p == MAP_FAILED ? NULL : p;
+#endif
+    }
+    
+    static void unmapPages(void* p, size_t bytes) {
+#ifdef _WIN32
+        (void)bytes;
+        VirtualFree(p, 0, MEM_RELEASE);
+#else
+        munmap(p, bytes);
+#endif
+    }
+    
+    Mapping* mapLocked(size_t bytes) {
+        if (byteLimit != 0 && mappedBytes + bytes > byteLimit) {
+            return NULL;
+        }
+        Mapping* m = static_cast<Mapping*>(mapPages(bytes));
+        if (!m) {
+            return NULL;
+        }
+        m->bytes = bytes;
+        m->prev = NULL;
+        m->next = mappings;
+        if (mappings) {
+            mappings->prev = m;
+        }
+        mappings = m;
+        mappedBytes += bytes;
+        return m;
+    }
+    
+    void unlinkLocked(Mapping* m) {
+        if (m->prev) {
+            m->prev->next = m->next;
+        } else {
+            mappings = m->next;
+        }
+        if (m->next) {
+            m->next->prev = m->prev;
+        }
+        mappedBytes -= m->bytes;
+    }
+    
+    void noteUsedLocked(size_t bytes) {
+        usedBytes += bytes;
+        if (usedBytes.load(std::memory_order_relaxed) > peakUsedBytes.load(std::memory_order_relaxed)) {
+            peakUsedBytes.store(usedBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+    }
+    
+public:
+    ProfilerArena() : mappings(NULL), cursor(NULL), limit(NULL), mappedBytes(0), usedBytes(0),
+                      peakUsedBytes(0), byteLimit(0) {
+        memset(freeLists, 0, sizeof(freeLists));
+    }
+    
+    // Returns zeroed memory, or NULL once the byte limit is reached.
+    void* allocate(size_t size) {
+        if (size == 0) {
+            size = 1;
+        }
+        lock.lock();
+        
+        if (size > LARGE_THRESHOLD) {
+            size_t bytes = (size + LARGE_HEADER + 4095) & ~size_t(4095);
+            Mapping* m = mapLocked(bytes);
+            if (m) {
+                noteUsedLocked(size);
+            }
+            lock.unlock();
+            return m ? reinterpret_cast<char*>(m) + LARGE_HEADER : NULL;
+        }
+        
+        size_t cls = sizeClass(size);
+        size_t blockSize = size_t(1) << (cls + MIN_CLASS_BITS);
+        void* block = freeLists[cls];
+        if (block) {
+            freeLists[cls] = freeLists[cls]->next;
+            memset(block, 0, blockSize);
+        } else {
+            if (cursor == NULL || static_cast<size_t>(limit - cursor) < blockSize) {
+                Mapping* m = mapLocked(CHUNK_SIZE);
+                if (!m) {
+                    lock.unlock();
+                    return NULL;
+                }
+                cursor = reinterpret_cast<char*>(m) + LARGE_HEADER;
+                limit = reinterpret_cast<char*>(m) + CHUNK_SIZE;
+            }
+            // Fresh pages from the OS are already zero.
+            block = cursor;
+            cursor += blockSize;
+        }
+        noteUsedLocked(blockSize);
+        lock.unlock();
+        return block;
+    }
+    
+    void deallocate(void* p, size_t size) {
+        if (!p) {
+            return;
+        }
+        if (size == 0) {
+            size = 1;
+        }
+        lock.lock();
+        
+        if (size > LARGE_THRESHOLD) {
+            Mapping* m = reinterpret_cast<Mapping*>(static_cast<char*>(p) - LARGE_HEADER);
+            unlinkLocked(m);
+            usedBytes -= size;
+            lock.unlock();
+            unmapPages(m, m->bytes);
+            return;
+        }
+        
+        size_t cls = sizeClass(size);
+        FreeBlock* block = static_cast<FreeBlock*>(p);
+        block->next = freeLists[cls];
+        freeLists[cls] = block;
+        usedBytes -= size_t(1) << (cls + MIN_CLASS_BITS);
+        lock.unlock();
+    }
+    
+    // Releases every mapping at once. Nothing allocated from the arena may
+    // be used afterwards.
+    void reset() {
+        lock.lock();
+        Mapping* m = mappings;
+        while (m) {
+            Mapping* next = m->next;
+            unmapPages(m, m->bytes);
+            m = next;
+        }
+        mappings = NULL;
+        cursor = NULL;
+        limit = NULL;
+        memset(freeLists, 0, sizeof(freeLists));
+        mappedBytes = 0;
+        usedBytes = 0;
+        peakUsedBytes = 0;
+        lock.unlock();
+    }
+    
+    // Caps the bytes mapped by this arena; 0 means unlimited.
+    void setByteLimit(size_t bytes) { byteLimit = bytes; }
+    
+    size_t mapped() const { return mappedBytes.load(std::memory_order_relaxed); }
+    size_t used() const { return usedBytes.load(std::memory_order_relaxed); }
+    size_t peakUsed() const { return peakUsedBytes.load(std::memory_order_relaxed); }
+};
+
+// Standard allocator over a ProfilerArena, for containers the profiler
+// fills while writing reports.
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+    
+    ProfilerArena* arena;
+    
+    explicit ArenaAllocator(ProfilerArena* a) : arena(a) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+    
+    T* allocate(size_t n) {
+        T* p = static_cast<T*>(arena->allocate(n * sizeof(T)));
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+    
+    void deallocate(T* p, size_t n) { arena->deallocate(p, n * sizeof(T)); }
+    
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+// How call stacks are captured when stack capture is enabled. Frame
+// pointer walking is cheap but needs code built with frame pointers;
+// libunwind (compiled in with MEMPROF_HAVE_LIBUNWIND) reads unwind tables
+// instead and is also used when the frame pointer walk finds nothing.
+enum StackUnwinder {
+    UNWIND_FRAME_POINTER,
+    UNWIND_LIBUNWIND
+};
+
+// Address range of the calling thread's stack, for validating frame
+// pointers; empty where the platform cannot report it.
+struct StackBounds {
+    uintptr_t low;
+    uintptr_t high;
+};
+
+inline const StackBounds& threadStackBounds() {
+    static thread_local StackBounds bounds = {0, 0};
+    static thread_local bool queried = false;
+    if (!queried) {
+        queried = true;
+#if defined(__linux__)
+        pthread_attr_t attr;
+        if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+            void* base = NULL;
+            size_t size = 0;
+            if (pthread_attr_getstack(&attr, &base, &size) == 0) {
+                bounds.low = reinterpret_cast<uintptr_t>(base);
+                bounds.high = bounds.low + size;
+            }
+            pthread_attr_destroy(&attr);
+        }
+#endif
+    }
+    return bounds;
+}
+
+// Collects return addresses by following saved frame pointers, starting
+// with the caller of this function.
+MEMPROF_NOINLINE inline uint32_t captureFramePointerStack(const void** frames, uint32_t maxDepth) {
+#if defined(__x86_64__) || defined(__aarch64__) || defined(__i386__)
+    const StackBounds& bounds = threadStackBounds();
+    void** fp = static_cast<void**>(__builtin_frame_address(0));
+    uint32_t depth = 0;
+    while (depth < maxDepth) {
+        uintptr_t at = reinterpret_cast<uintptr_t>(fp);
+        if ((at & (sizeof(void*) - 1)) != 0) {
+            break;
+        }
+        if (bounds.high != 0 && (at < bounds.low || at + 2 * sizeof(void*) > bounds.high)) {
+            break;
+        }
+        const void* ret = fp[1];
+        if (!ret) {
+            break;
+        }
+        frames[depth++] = ret;
+        
+        void** next = static_cast<void**>(fp[0]);
+        // Frames only grow towards higher addresses; anything else means the
+        // chain is broken by code built without frame pointers.
+        if (next <= fp || (bounds.high == 0 && reinterpret_cast<uintptr_t>(next) - at > (size_t(1) << 20))) {
+            break;
+        }
+        fp = next;
+    }
+    return depth;
+#else
+    (void)frames;
+    (void)maxDepth;
+    return 0;
+#endif
+}
+
+inline uint32_t captureStack(const void** frames, uint32_t maxDepth, StackUnwinder unwinder) {
+#if defined(_WIN32)
+    (void)unwinder;
+    return RtlCaptureStackBackTrace(0, static_cast<DWORD>(maxDepth), const_cast<PVOID*>(frames), NULL);
+#else
+#ifdef MEMPROF_HAVE_LIBUNWIND
+    uint32_t depth = 0;
+    if (unwinder == UNWIND_FRAME_POINTER) {
+        depth = captureFramePointerStack(frames, maxDepth);
+    }
+    if (depth < 2) {
+        int unwound = unw_backtrace(const_cast<void**>(frames), static_cast<int>(maxDepth));
+        depth = unwound > 0 ? static_cast<uint32_t>(unwound) : 0;
+    }
+    return depth;
+#else
+    (void)unwinder;
+    return captureFramePointerStack(frames, maxDepth);
+#endif
+#endif
+}
+
+struct RemoteFrees;
+struct SiteBatch;
+
+// Counters owned by one thread. Only the owner writes them, readers sum
+// every registered block when a report is generated. Bytes are those of
+// the thread's own blocks: freedBytes counts the ones it freed itself,
+// frees by other threads arrive through the cells on `incoming`. A block
+// whose thread has exited is handed to the next new thread. The one
+// `shared` block is written by many threads and updated atomically.
+struct ThreadCounters {
+    std::atomic<size_t> allocations;
+    std::atomic<size_t> deallocations;
+    std::atomic<size_t> allocatedBytes;
+    std::atomic<size_t> freedBytes;
+    std::atomic<size_t> peakBytes;
+    std::atomic<uint64_t> peakNanos;
+    // Sum of the incoming cells when the owner last added them up.
+    std::atomic<size_t> remoteFreedBytes;
+    // Part of the incoming cells that was freed from the previous thread's
+    // blocks, before the block was handed over.
+    std::atomic<size_t> remoteBase;
+    std::atomic<RemoteFrees*> incoming;
+    std::atomic<RemoteFrees*> outgoing;
+    // Site counts not yet added to the call site table; NULL for the shared
+    // block, which updates the sites directly.
+    SiteBatch* sites;
+    std::atomic<bool> owned;
+    bool shared;
+    int threadId;
+    ThreadCounters* next;
+    
+    ThreadCounters() : allocations(0), deallocations(0), allocatedBytes(0), freedBytes(0), peakBytes(0), peakNanos(0),
+                       remoteFreedBytes(0), remoteBase(0), incoming(NULL), outgoing(NULL),
+                       sites(NULL), owned(true), shared(false), threadId(0), next(NULL) {}
+};
+
+// Frees one thread made of blocks another thread allocated. Only the
+// freeing thread writes the counters. A cell is pushed onto its owner's
+// `incoming` list when first used and never removed, so the list needs
+// no lock and the owner adds the cells up only when it needs its total.
+// Cells stay with the two counter blocks when those are handed to new
+// threads, so there are at most as many as pairs of blocks.
+struct RemoteFrees {
+    ThreadCounters* owner;
+    ThreadCounters* freer;
+    std::atomic<size_t> count;
+    std::atomic<size_t> bytes;
+    RemoteFrees* nextIncoming;
+    RemoteFrees* nextOutgoing;
+    
+    RemoteFrees(ThreadCounters* allocatedBy, ThreadCounters* freedBy)
+        : owner(allocatedBy), freer(freedBy), count(0), bytes(0), nextIncoming(NULL), nextOutgoing(NULL) {}
+};
+
+inline size_t incomingFreedBytes(const ThreadCounters& counters) {
+    size_t bytes = 0;
+    for (RemoteFrees* cell = counters.incoming.load(std::memory_order_acquire); cell; cell = cell->nextIncoming) {
+        bytes += cell->bytes.load(std::memory_order_relaxed);
+    }
+    size_t base = counters.remoteBase.load(std::memory_order_relaxed);
+    return bytes > base ? bytes - base : 0;
+}
+
+// Maps the thread id in an allocation record to the counters the thread
+// that made it holds, until the block is handed to a new thread. An id the
+// OS hands out again maps to the newest thread; ids that find no free slot
+// are left out, and frees of their blocks go to the shared counters. The
+// slots come from the arena, zeroed, on the first add, so a process with
+// few threads touches few of their pages. Adds and removes take the lock;
+// lookups do not, and re-read the id to catch a slot changing under them.
+class ThreadDirectory {
+private:
+    static const size_t SLOTS = 16384;
+    
+    // An empty slot ends a probe; a removed one keeps its counters and has
+    // id 0, so probes go on past it and an add can reuse it.
+    struct Slot {
+        std::atomic<int> threadId;
+        std::atomic<ThreadCounters*> counters;
+    };
+    
+    ProfilerArena& arena;
+    std::atomic<Slot*> slots;
+    SpinLock lock;
+    
+    static size_t slotOf(int threadId) {
+        return (static_cast<uint32_t>(threadId) * 2654435761u) % SLOTS;
+    }
+
+public:
+    explicit ThreadDirectory(ProfilerArena& source) : arena(source), slots(NULL) {}
+    
+    void add(int threadId, ThreadCounters* counters) {
+        lock.lock();
+        Slot* table = slots.load(std::memory_order_relaxed);
+        if (!table) {
+            table = static_cast<Slot*>(arena.allocate(SLOTS * sizeof(Slot)));
+            slots.store(table, std::memory_order_release);
+        }
+        Slot* reuse = NULL;
+        size_t slot = slotOf(threadId);
+        for (size_t probe = 0; table && probe < SLOTS; probe++, slot = (slot + 1) % SLOTS) {
+            Slot& entry = table[slot];
+            if (entry.counters.load(std::memory_order_relaxed) == NULL) {
+                reuse = reuse ? reuse : &entry;
+                break;
+            }
+            int current = entry.threadId.load(std::memory_order_relaxed);
+            if (current == threadId) {
+                reuse = &entry;
+                break;
+            }
+            if (current == 0 && !reuse) {
+                reuse = &entry;
+            }
+        }
+        if (reuse) {
+            reuse->threadId.store(0, std::memory_order_release);
+            reuse->counters.store(counters, std::memory_order_release);
+            reuse->threadId.store(threadId, std::memory_order_release);
+        }
+        lock.unlock();
+    }
+    
+    void remove(int threadId, ThreadCounters* counters) {
+        lock.lock();
+        Slot* table = slots.load(std::memory_order_relaxed);
+        size_t slot = slotOf(threadId);
+        for (size_t probe = 0; table && probe < SLOTS; probe++, slot = (slot + 1) % SLOTS) {
+            Slot& entry = table[slot];
+            if (entry.counters.load(std::memory_order_relaxed) == NULL) {
+                break;
+            }
+            if (entry.threadId.load(std::memory_order_relaxed) == threadId) {
+                if (entry.counters.load(std::memory_order_relaxed) == counters) {
+                    entry.threadId.store(0, std::memory_order_release);
+                }
+                break;
+            }
+        }
+        lock.unlock();
+    }
+    
+    ThreadCounters* find(int threadId) const {
+        Slot* table = slots.load(std::memory_order_acquire);
+        size_t slot = slotOf(threadId);
+        for (size_t probe = 0; table && threadId != 0 && probe < SLOTS; probe++, slot = (slot + 1) % SLOTS) {
+            Slot& entry = table[slot];
+            ThreadCounters* counters = entry.counters.load(std::memory_order_acquire);
+            if (counters == NULL) {
+                return NULL;
+            }
+            if (entry.threadId.load(std::memory_order_acquire) == threadId) {
+                counters = entry.counters.load(std::memory_order_acquire);
+                return entry.threadId.load(std::memory_order_acquire) == threadId ? counters : NULL;
+            }
+        }
+        return NULL;
+    }
+};
+
+// Per-thread state of the byte-interval sampler. bytesUntilSample counts
+// down with every allocation; when it crosses zero the allocation is
+// sampled and a new exponentially distributed interval is drawn, which
+// makes sample points a Poisson process over allocated bytes.
+struct SamplerState {
+    int64_t bytesUntilSample;
+    size_t interval;
+    uint64_t rng;
+    
+    // Exponential variate with the given mean, from a xorshift generator.
+    int64_t nextInterval(size_t mean) {
+        if (rng == 0) {
+            rng = (static_cast<uint64_t>(currentThreadId()) << 32) ^ monotonicNanos() ^ 0x9e3779b97f4a7c15ULL;
+        }
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        double u = (static_cast<double>(rng >> 11) + 1.0) / 9007199254740993.0;
+        return static_cast<int64_t>(-std::log(u) * static_cast<double>(mean)) + 1;
+    }
+};
+
+// Interns records into dense ids. Each Record has a `key` member whose type
+// provides hash(), operator== and persist(); persist() copies anything the
+// key points at into the arena before a new record is stored. Records sit
+// in fixed chunks so an id stays valid while the table grows, and reading
+// one takes no lock.
+template <typename Record>
+class InternTable {
+public:
+    typedef typename Record::Key Key;
+    static const uint32_t NO_ID = UINT32_MAX;
+    
+private:
+    static const size_t CHUNK_BITS = 10;
+    static const size_t CHUNK_SIZE = size_t(1) << CHUNK_BITS;
+    static const size_t MAX_CHUNKS = 1024;
+    
+    std::atomic<Record*> chunks[MAX_CHUNKS];
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> generation;
+    
+    ProfilerArena& arena;
+    SpinLock lock;
+    uint32_t* index;
+    size_t indexCapacity;
+    
+    uint32_t findLocked(const Key& key, size_t& pos) const {
+        size_t mask = indexCapacity - 1;
+        pos = key.hash() & mask;
+        while (index[pos] != 0) {
+            const Record& record = get(index[pos] - 1);
+            if (record.key == key) {
+                return index[pos] - 1;
+            }
+            pos = (pos + 1) & mask;
+        }
+        return NO_ID;
+    }
+    
+    bool growIndexLocked() {
+        size_t newCapacity = indexCapacity == 0 ? 1024 : indexCapacity * 2;
+        uint32_t* newIndex = static_cast<uint32_t*>(arena.allocate(newCapacity * sizeof(uint32_t)));
+        if (!newIndex) {
+            return false;
+        }
+        for (size_t i = 0; i < indexCapacity; i++) {
+            if (index[i] != 0) {
+                const Record& record = get(index[i] - 1);
+                size_t pos = record.key.hash() & (newCapacity - 1);
+                while (newIndex[pos] != 0) {
+                    pos = (pos + 1) & (newCapacity - 1);
+                }
+                newIndex[pos] = index[i];
+            }
+        }
+        arena.deallocate(index, indexCapacity * sizeof(uint32_t));
+        index = newIndex;
+        indexCapacity = newCapacity;
+        return true;
+    }
+    
+public:
+    explicit InternTable(ProfilerArena& a) : count(0), generation(0), arena(a), index(NULL), indexCapacity(0) {
+        for (size_t i = 0; i < MAX_CHUNKS; i++) {
+            chunks[i].store(NULL, std::memory_order_relaxed);
+        }
+    }
+    
+    // Returns NO_ID when the profiler arena is exhausted.
+    uint32_t intern(const Key& key) {
+        lock.lock();
+        if ((count.load(std::memory_order_relaxed) + 1) * 2 > indexCapacity && !growIndexLocked() &&
+            count.load(std::memory_order_relaxed) + 1 >= indexCapacity) {
+            lock.unlock();
+            return NO_ID;
+        }
+        
+        size_t pos;
+        uint32_t id = findLocked(key, pos);
+        if (id == NO_ID) {
+            id = count.load(std::memory_order_relaxed);
+            size_t chunk = id >> CHUNK_BITS;
+            Key stored = key;
+            if (chunk >= MAX_CHUNKS || !stored.persist(arena)) {
+                lock.unlock();
+                return NO_ID;
+            }
+            if (!chunks[chunk].load(std::memory_order_relaxed)) {
+                Record* records = static_cast<Record*>(arena.allocate(CHUNK_SIZE * sizeof(Record)));
+                if (!records) {
+                    lock.unlock();
+                    return NO_ID;
+                }
+                chunks[chunk].store(records, std::memory_order_release);
+            }
+            Record& record = chunks[chunk].load(std::memory_order_relaxed)[id & (CHUNK_SIZE - 1)];
+            record.key = stored;
+            index[pos] = id + 1;
+            count.store(id + 1, std::memory_order_release);
+        }
+        lock.unlock();
+        return id;
+    }
+    
+    Record& get(uint32_t id) const {
+        return chunks[id >> CHUNK_BITS].load(std::memory_order_acquire)[id & (CHUNK_SIZE - 1)];
+    }
+    
+    uint32_t size() const { return count.load(std::memory_order_acquire); }
+    
+    // Bumped by reset() so per-thread caches drop ids from before it.
+    uint32_t currentGeneration() const { return generation.load(std::memory_order_acquire); }
+    
+    // Forgets every record. The memory itself goes away with the arena reset.
+    void reset() {
+        lock.lock();
+        for (size_t i = 0; i < MAX_CHUNKS; i++) {
+            chunks[i].store(NULL, std::memory_order_relaxed);
+        }
+        index = NULL;
+        indexCapacity = 0;
+        count.store(0, std::memory_order_relaxed);
+        generation.fetch_add(1, std::memory_order_release);
+        lock.unlock();
+    }
+};
+
+// A captured call stack, innermost frame first. Frames live in the arena
+// once the stack has been interned.
+struct StackKey {
+    const void* const* frames;
+    uint32_t depth;
+    uint64_t hashValue;
+    
+    static uint64_t hashFrames(const void* const* frames, uint32_t depth) {
+        uint64_t h = 0xcbf29ce484222325ULL ^ depth;
+        for (uint32_t i = 0; i < depth; i++) {
+            h ^= static_cast<uint64_t>(reinterpret_cast<uintptr_t>(frames[i]));
+            h *= 0x100000001b3ULL;
+            h ^= h >> 29;
+        }
+        return h;
+    }
+    
+    bool operator==(const StackKey& other) const {
+        return hashValue == other.hashValue && depth == other.depth &&
+               memcmp(frames, other.frames, depth * sizeof(void*)) == 0;
+    }
+    
+    uint64_t hash() const { return hashValue; }
+    
+    bool persist(ProfilerArena& arena) {
+        void* copy = arena.allocate(depth * sizeof(void*));
+        if (!copy) {
+            return false;
+        }
+        memcpy(copy, frames, depth * sizeof(void*));
+        frames = static_cast<const void* const*>(copy);
+        return true;
+    }
+};
+
+struct StackRecord {
+    typedef StackKey Key;
+    StackKey key;
+};
+
+typedef InternTable<StackRecord> StackTable;
+
+// Where an allocation came from: the address of a __FILE__ literal and a
+// line for allocations made through the `new` macro, the return address of
+// the allocation call, and the interned stack when stacks are captured.
+struct CallSiteKey {
+    const char* file;
+    int line;
+    const void* caller;
+    uint32_t stackId;
+    
+    bool operator==(const CallSiteKey& other) const {
+        return file == other.file && line == other.line && caller == other.caller && stackId == other.stackId;
+    }
+    
+    uint64_t hash() const {
+        uint64_t h = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(file)) * 0x9e3779b97f4a7c15ULL;
+        h ^= static_cast<uint64_t>(static_cast<uint32_t>(line)) + (h >> 29);
+        h ^= static_cast<uint64_t>(reinterpret_cast<uintptr_t>(caller)) * 0xc2b2ae3d27d4eb4fULL;
+        h ^= static_cast<uint64_t>(stackId) << 17;
+        return h * 0xff51afd7ed558ccdULL;
+    }
+    
+    bool persist(ProfilerArena&) { return true; }
+};
+
+inline uint32_t log2Floor(uint64_t value) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    return _BitScanReverse64(&index, value) ? static_cast<uint32_t>(index) : 0;
+#else
+    return value == 0 ? 0 : 63 - static_cast<uint32_t>(__builtin_clzll(value));
+#endif
+}
+
+// Size class k holds sizes in [2^k, 2^(k+1)); the last one is open-ended.
+static const uint32_t SIZE_CLASSES = 24;
+
+inline uint32_t sizeClassOf(size_t size) {
+    uint32_t k = log2Floor(size);
+    return k < SIZE_CLASSES - 1 ? k : SIZE_CLASSES - 1;
+}
+
+// Lifetime class 0 is under 1 us and class k below 4^k us; the last one is
+// open-ended.
+static const uint32_t LIFETIME_CLASSES = 12;
+
+inline uint32_t lifetimeClassOf(uint64_t nanos) {
+    uint64_t micros = nanos / 1000;
+    uint32_t k = micros == 0 ? 0 : 1 + log2Floor(micros) / 2;
+    return k < LIFETIME_CLASSES - 1 ? k : LIFETIME_CLASSES - 1;
+}
+
+inline void raiseTo(std::atomic<size_t>& target, size_t value) {
+    size_t current = target.load(std::memory_order_relaxed);
+    while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+// Per-site statistics. Threads add their counts in batches (see SiteBatch);
+// all updates are relaxed atomic adds. smallestInverse holds ~size of the
+// smallest allocation so that, like every other field, it starts at zero
+// and only grows.
+struct CallSite {
+    typedef CallSiteKey Key;
+    CallSiteKey key;
+    std::atomic<size_t> allocations;
+    std::atomic<size_t> allocatedBytes;
+    std::atomic<size_t> liveCount;
+    std::atomic<size_t> liveBytes;
+    std::atomic<size_t> peakLive;
+    std::atomic<size_t> largest;
+    std::atomic<size_t> smallestInverse;
+    std::atomic<size_t> sizeClasses[SIZE_CLASSES];
+    std::atomic<size_t> lifetimes[LIFETIME_CLASSES];
+};
+
+typedef InternTable<CallSite> CallSiteTable;
+
+// One site's counts that a thread has not yet added to the CallSite.
+// Live counts are deltas and may go below zero; liveHigh is the highest
+// liveCount reached since the entry was last added in.
+struct PendingSite {
+    uint32_t siteId;  // + 1, so a zeroed entry is empty
+    size_t allocations;
+    size_t allocatedBytes;
+    int64_t liveCount;
+    int64_t liveBytes;
+    int64_t liveHigh;
+    size_t sizeClasses[SIZE_CLASSES];
+    size_t lifetimes[LIFETIME_CLASSES];
+};
+
+// Direct-mapped cache of the sites a thread recently allocated from or
+// freed to. The lock is only contended while a reader adds the entries
+// in, so a hot site costs its thread plain adds instead of an atomic add
+// on a shared line per counter. An entry is added in when another site
+// takes its slot and before anything reads the site counters.
+struct SiteBatch {
+    static const size_t SLOTS = 16;
+    SpinLock lock;
+    PendingSite slots[SLOTS];
+};
+
+inline uint64_t hashPointer(const void* ptr) {
+    uint64_t h = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(ptr)) >> 4;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Flat table of live allocations keyed by address, using linear probing.
+// Erasing shifts the rest of the probe run back into the hole instead of
+// leaving a tombstone, so probe lengths depend only on the live entries and
+// a freed block costs nothing once it is gone. Storage comes from the
+// profiler arena; the table itself is not synchronized.
+class PointerTable {
+private:
+    static const size_t INITIAL_CAPACITY = 256;
+    
+    ProfilerArena* arena;
+    AllocationInfo* slots;
+    size_t capacity;
+    size_t count;
+    
+    bool grow() {
+        size_t newCapacity = capacity == 0 ? INITIAL_CAPACITY : capacity * 2;
+        AllocationInfo* newSlots = static_cast<AllocationInfo*>(arena->allocate(newCapacity * sizeof(AllocationInfo)));
+        if (!newSlots) {
+            return false;
+        }
+        
+        size_t mask = newCapacity - 1;
+        for (size_t i = 0; i < capacity; i++) {
+            if (slots[i].address != NULL) {
+                size_t pos = hashPointer(slots[i].address) & mask;
+                while (newSlots[pos].address != NULL) {
+                    pos = (pos + 1) & mask;
+                }
+                newSlots[pos] = slots[i];
+            }
+        }
+        arena->deallocate(slots, capacity * sizeof(AllocationInfo));
+        slots = newSlots;
+        capacity = newCapacity;
+        return true;
+    }
+    
+public:
+    explicit PointerTable(ProfilerArena* a = NULL) : arena(a), slots(NULL), capacity(0), count(0) {}
+    
+    void setArena(ProfilerArena* a) { arena = a; }
+    
+    // Stores info under info.address. A record already stored for that
+    // address is replaced and returned through previous. Fails only when the
+    // table is full and the arena cannot grow it.
+    bool insert(const AllocationInfo& info, uint64_t hash, AllocationInfo* previous) {
+        if ((count + 1) * 10 > capacity * 7 && !grow() && count + 1 >= capacity) {
+            return false;
+        }
+        
+        size_t mask = capacity - 1;
+        size_t pos = hash & mask;
+        while (slots[pos].address != NULL) {
+            if (slots[pos].address == info.address) {
+                if (previous) {
+                    *previous = slots[pos];
+                }
+                slots[pos] = info;
+                return true;
+            }
+            pos = (pos + 1) & mask;
+        }
+        
+        if (previous) {
+            previous->address = NULL;
+        }
+        slots[pos] = info;
+        count++;
+        return true;
+    }
+    
+    AllocationInfo* find(const void* ptr, uint64_t hash) const {
+        if (capacity == 0) {
+            return NULL;
+        }
+        size_t mask = capacity - 1;
+        size_t pos = hash & mask;
+        while (slots[pos].address != NULL) {
+            if (slots[pos].address == ptr) {
+                return &slots[pos];
+            }
+            pos = (pos + 1) & mask;
+        }
+        return NULL;
+    }
+    
+    bool erase(const void* ptr, uint64_t hash, AllocationInfo* removed) {
+        AllocationInfo* found = find(ptr, hash);
+        if (!found) {
+            return false;
+        }
+        if (removed) {
+            *removed = *found;
+        }
+        
+        size_t mask = capacity - 1;
+        size_t hole = static_cast<size_t>(found - slots);
+        size_t pos = (hole + 1) & mask;
+        while (slots[pos].address != NULL) {
+            size_t home = hashPointer(slots[pos].address) & mask;
+            // Move the entry back if the hole lies between its home slot and
+            // where it sits now (cyclically).
+            if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+                slots[hole] = slots[pos];
+                hole = pos;
+            }
+            pos = (pos + 1) & mask;
+        }
+        slots[hole].address = NULL;
+        count--;
+        return true;
+    }
+    
+    template <typename Visitor>
+    void forEach(Visitor visit) const {
+        for (size_t i = 0; i < capacity; i++) {
+            if (slots[i].address != NULL) {
+                visit(slots[i]);
+            }
+        }
+    }
+    
+    // Returns the slot array to the arena.
+    void release() {
+        if (slots) {
+            arena->deallocate(slots, capacity * sizeof(AllocationInfo));
+        }
+        forget();
+    }
+    
+    // Drops the slot array without returning it, for when the whole arena
+    // is about to be reset.
+    void forget() {
+        slots = NULL;
+        capacity = 0;
+        count = 0;
+    }
+    
+    size_t size() const { return count; }
+    size_t bytes() const { return capacity * sizeof(AllocationInfo); }
+};
+
+// One slice of the allocation table. A pointer always hashes to the same
+// shard, so threads touching different addresses rarely share a lock.
+struct alignas(64) AllocationShard {
+    SpinLock lock;
+    PointerTable table;
+};
+
+// Append-only trace file written through a sliding memory-mapped window.
+// The file is grown one window at a time and cut back to the bytes actually
+// written when it is closed.
+class TraceFile {
+private:
+    static const size_t WINDOW_BYTES = size_t(16) << 20;
+    
+    int fd;
+    char* window;
+    uint64_t windowOffset;
+    size_t cursor;
+    
+    bool mapWindow(uint64_t offset) {
+#ifdef _WIN32
+        (void)offset;
+        return false;
+#else
+        if (window) {
+            munmap(window, WINDOW_BYTES);
+            window = NULL;
+        }
+        if (ftruncate(fd, static_cast<off_t>(offset + WINDOW_BYTES)) != 0) {
+            return false;
+        }
+        void* mapped = mmap(NULL, WINDOW_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, static_cast<off_t>(offset));
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        window = static_cast<char*>(mapped);
+        windowOffset = offset;
+        cursor = 0;
+        return true;
+#endif
+    }
+    
+public:
+    TraceFile() : fd(-1), window(NULL), windowOffset(0), cursor(0) {}
+    
+    bool open(const char* path) {
+#ifdef _WIN32
+        (void)path;
+        return false;
+#else
+        fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        if (!mapWindow(0)) {
+            close();
+            return false;
+        }
+        return true;
+#endif
+    }
+    
+    bool isOpen() const { return window != NULL; }
+    
+    bool append(const void* data, size_t bytes) {
+        const char* from = static_cast<const char*>(data);
+        while (bytes > 0) {
+            if (cursor == WINDOW_BYTES && !mapWindow(windowOffset + WINDOW_BYTES)) {
+                return false;
+            }
+            size_t piece = WINDOW_BYTES - cursor < bytes ? WINDOW_BYTES - cursor : bytes;
+            memcpy(window + cursor, from, piece);
+            cursor += piece;
+            from += piece;
+            bytes -= piece;
+        }
+        return true;
+    }
+    
+    void close() {
+#ifndef _WIN32
+        if (window) {
+            munmap(window, WINDOW_BYTES);
+            window = NULL;
+        }
+        if (fd >= 0) {
+            if (ftruncate(fd, static_cast<off_t>(windowOffset + cursor)) != 0) {
+                // The unwritten tail reads as zeros, which ends the trace.
+            }
+            ::close(fd);
+            fd = -1;
+        }
+#endif
+        windowOffset = 0;
+        cursor = 0;
+    }
+};
+
+// Single-producer single-consumer queue of trace events. The owning thread
+// pushes, the flusher thread pops. When a thread exits its ring is handed
+// to the next thread that starts streaming, so the number of rings never
+// exceeds the number of threads alive at once.
+struct TraceRing {
+    std::atomic<uint64_t> head;
+    char headPadding[64 - sizeof(std::atomic<uint64_t>)];
+    std::atomic<uint64_t> tail;
+    char tailPadding[64 - sizeof(std::atomic<uint64_t>)];
+    std::atomic<bool> owned;
+    uint64_t flushTo;
+    size_t capacity;
+    TraceEvent* events;
+    TraceRing* next;
+};
+
+// Estimated live allocations attributed to one call site, or to one
+// report row once sites with the same location are merged.
+struct LeakTotals {
+    size_t count;
+    size_t bytes;
+};
+
+struct TimelinePoint {
+    uint64_t nanos;
+    size_t bytes;
+};
+
+// A named marker of the heap's state. Allocation timestamps place every
+// record before or after it, so the tracking table is never copied; only
+// the live totals of each call site are, indexed by site id.
+struct HeapSnapshot {
+    std::string name;
+    uint64_t nanos;
+    std::vector<LeakTotals> sites;
+};
+
+enum HeapErrorType {
+    DOUBLE_FREE,
+    INVALID_FREE,
+    MISMATCHED_FREE,
+    WRITE_AFTER_FREE,
+    HEAP_ERROR_TYPES
+};
+
+// Misuse of the heap caught in quarantine mode. block is the allocation
+// involved, with siteId NO_ID for a pointer that was never allocated;
+// caller is the code that freed it, when known, and offset the first
+// byte written after a free.
+struct HeapError {
+    HeapErrorType type;
+    AllocationInfo block;
+    AllocationKind freedAs;
+    const void* caller;
+    size_t offset;
+    uint64_t nanos;
+    int threadId;
+};
+
+// Change in one report row's live allocations between two heap states.
+struct SiteDelta {
+    uint32_t row;
+    long long count;
+    long long bytes;
+    bool added;
+};
+
+template <typename Policy>
+class BasicMemoryProfiler {
+private:
+    static const size_t SHARD_BITS = 6;
+    static const size_t SHARD_COUNT = size_t(1) << SHARD_BITS;
+    
+    // The tracking tables live in a bounded arena that reset() throws away.
+    // Per-thread counter blocks, which thread_local pointers keep reaching,
+    // and the leak list built for reports live in the second arena.
+    ProfilerArena arena;
+    ProfilerArena metaArena;
+    
+    AllocationShard shards[SHARD_COUNT];
+    std::atomic<ThreadCounters*> threadList;
+    ThreadDirectory threadDirectory;
+    // Totals of exited threads whose blocks were handed on, and of threads
+    // left without a block of their own. Always on threadList.
+    ThreadCounters sharedCounters;
+    std::atomic<size_t> retiredThreads;
+    CallSiteTable callSites;
+    StackTable stacks;
+    
+    // Frames kept per stack, 0 when stacks are not captured.
+    std::atomic<uint32_t> stackDepth;
+    std::atomic<int> stackUnwinder;
+    
+    // Symbol names resolved while writing reports, keyed by code address.
+    std::unordered_map<const void*, std::string> symbolCache;
+    
+    time_t startWallClock;
+    uint64_t startNanos;
+    
+    // Live bytes over all threads. This is the one counter every tracked
+    // allocation and free updates; it keeps the peak exact.
+    std::atomic<size_t> currentMemoryUsage;
+    std::atomic<size_t> peakMemoryUsage;
+    std::atomic<uint64_t> peakNanos;
+    
+    // Live totals per site at the highest peak seen so far. A new snapshot
+    // is taken once usage passes nextPeakSnapshot, 1/16 above the last one,
+    // so a steadily growing heap is not copied on every allocation.
+    std::vector<LeakTotals, ArenaAllocator<LeakTotals> > peakSites;
+    size_t peakSnapshotBytes;
+    uint64_t peakSnapshotNanos;
+    std::atomic<size_t> nextPeakSnapshot;
+    SpinLock peakLock;
+    
+    // Usage sampled by a background thread from the per-thread byte
+    // counters. When the buffer fills, neighbouring points are merged,
+    // keeping the higher one, and the stride between points doubles.
+    static const size_t TIMELINE_POINTS = 1024;
+    TimelinePoint timeline[TIMELINE_POINTS];
+    TimelinePoint timelinePending;
+    size_t timelineSize;
+    uint32_t timelineStride;
+    uint32_t timelineSkip;
+    std::atomic<size_t> timelineInterval;
+    std::thread timelineThread;
+    std::mutex timelineMutex;
+    std::condition_variable timelineWake;
+    bool stopTimeline;
+    std::atomic<size_t> droppedRecords;
+    
+    // Mean bytes between samples, 0 to record every allocation. The filter
+    // has a bit set for every address hash sampled since it was last built,
+    // so frees of blocks that were never sampled can return without
+    // touching the table. Bits of freed blocks stay set, so once another
+    // quarter of the bits has been set the filter is rebuilt from the live
+    // records into the spare buffer. While streaming there is no table to
+    // rebuild it from, and bits only accumulate.
+    std::atomic<size_t> samplingInterval;
+    std::atomic<std::atomic<uint64_t>*> sampledFilter;
+    std::atomic<uint64_t>* spareFilter;
+    std::atomic<size_t> filterBitsSet;
+    std::atomic<size_t> filterRebuildAt;
+    SpinLock filterLock;
+    static const size_t FILTER_WORDS = size_t(1) << 16;
+    
+    // Filled by detectLeaks(): live totals indexed by site id, with one
+    // extra slot for allocations without a site, and the largest live
+    // allocations kept as a min-heap of at most reportRows records.
+    std::vector<LeakTotals, ArenaAllocator<LeakTotals> > leakSites;
+    std::vector<AllocationInfo, ArenaAllocator<AllocationInfo> > leakList;
+    size_t leakRecords;
+    size_t leakCount;
+    size_t leakedBytes;
+    size_t reportRows;
+    
+    std::ostream* logStream;
+    
+    // Streaming mode sends events through per-thread rings to a trace file
+    // instead of keeping them in the allocation table. The shared ring takes
+    // events from threads whose own ring has already been released.
+    std::atomic<bool> streaming;
+    std::atomic<bool> flusherRunning;
+    std::atomic<TraceRing*> ringList;
+    TraceRing* sharedRing;
+    SpinLock sharedRingLock;
+    size_t ringCapacity;
+    TraceFile traceFile;
+    std::string tracePath;
+    std::thread flusher;
+    std::mutex flushMutex;
+    std::condition_variable flushWake;
+    bool stopFlush;
+    // Held while a batch is written; sitesWritten is the number of call
+    // sites already defined in the trace.
+    std::mutex drainMutex;
+    uint32_t sitesWritten;
+    std::mutex symbolMutex;
+    
+    // Debug quarantine. Freed blocks are poisoned and held back from the
+    // allocator in a FIFO ring, indexed by address to catch double frees,
+    // and released oldest first once quarantineLimit bytes or every slot
+    // are in use. quarantineBudget mirrors the limit for the free path and
+    // is 0 when the quarantine is off.
+    static const unsigned char POISON_BYTE = 0xdb;
+    static const size_t MAX_HEAP_ERRORS = 1000;
+    std::atomic<size_t> quarantineBudget;
+    SpinLock quarantineLock;
+    size_t quarantineLimit;
+    void (*releaseBlock)(void*);
+    AllocationInfo* quarantine;
+    size_t quarantineCapacity;
+    size_t quarantineHead;
+    size_t quarantineCount;
+    size_t quarantineBytes;
+    PointerTable quarantined;
+    // Set by reset(): blocks allocated before it are no longer known, so an
+    // unknown pointer is not necessarily an invalid free.
+    bool tableForgotten;
+    // The first MAX_HEAP_ERRORS errors, and a count of every error by type.
+    SpinLock heapErrorLock;
+    HeapError* heapErrorLog;
+    size_t heapErrorsLogged;
+    std::atomic<size_t> heapErrorCounts[HEAP_ERROR_TYPES];
+    
+    std::vector<HeapSnapshot> snapshots;
+    std::mutex snapshotMutex;
+    static const size_t MAX_SNAPSHOTS = 64;
+    // How many snapshots an allocation must outlive to be listed in the report.
+    size_t survivorSnapshots;
+    
+    // Introspection server. Its thread owns the growth tracking below and
+    // holds introspectionMutex while it reads the call site table.
+    std::atomic<bool> introspecting;
+    std::thread introspectionThread;
+    std::mutex introspectionMutex;
+    std::string socketPath;
+    std::vector<size_t> lastLiveBytes;
+    std::vector<size_t> growthStart;
+    std::vector<uint32_t> growthStreak;
+    
+    AllocationShard& shardFor(uint64_t hash) {
+        return shards[hash >> (64 - SHARD_BITS)];
+    }
+    
+    // Set while the current thread is inside the profiler, so allocations
+    // made by its own bookkeeping are not recorded again.
+    static bool& inProfiler() {
+        static thread_local bool active = false;
+        return active;
+    }
+    
+    struct ProfilerScope {
+        bool previous;
+        ProfilerScope() : previous(inProfiler()) { inProfiler() = true; }
+        ~ProfilerScope() { inProfiler() = previous; }
+    };
+    
+    // Marks a background thread of the profiler for good, so the frees of
+    // its start-up state after its loop returns are not recorded either.
+    static void enterProfilerThread() {
+        inProfiler() = true;
+    }
+    
+    // The calling thread's counters: a block left by an exited thread when
+    // there is one, else a new one. Threads that find no memory for a block,
+    // or allocate after their thread_locals are gone, use the shared one.
+    ThreadCounters& threadCounters() {
+        struct Owner {
+            ThreadCounters* counters;
+            bool exited;
+            ~Owner() {
+                if (counters && !counters->shared) {
+                    counters->owned.store(false, std::memory_order_release);
+                }
+                counters = NULL;
+                exited = true;
+            }
+        };
+        static thread_local Owner owner = {NULL, false};
+        
+        if (!owner.counters) {
+            if (owner.exited) {
+                return sharedCounters;
+            }
+            owner.counters = claimCounters();
+        }
+        return *owner.counters;
+    }
+    
+    ThreadCounters* claimCounters() {
+        int threadId = currentThreadId();
+        for (ThreadCounters* t = threadList.load(std::memory_order_acquire); t; t = t->next) {
+            bool expected = false;
+            if (!t->shared && !t->owned.load(std::memory_order_relaxed) &&
+                t->owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                retireCounters(*t);
+                t->threadId = threadId;
+                threadDirectory.add(threadId, t);
+                return t;
+            }
+        }
+        void* memory = metaArena.allocate(sizeof(ThreadCounters));
+        if (!memory) {
+            return &sharedCounters;
+        }
+        ThreadCounters* counters = ::new (memory) ThreadCounters();
+        counters->threadId = threadId;
+        void* batch = metaArena.allocate(sizeof(SiteBatch));
+        if (batch) {
+            // The arena hands out zeroed memory, so every slot starts empty.
+            counters->sites = ::new (batch) SiteBatch;
+        }
+        ThreadCounters* head = threadList.load(std::memory_order_relaxed);
+        do {
+            counters->next = head;
+        } while (!threadList.compare_exchange_weak(head, counters, std::memory_order_release,
+                                                   std::memory_order_relaxed));
+        threadDirectory.add(threadId, counters);
+        return counters;
+    }
+    
+    // Moves an exited thread's totals to the shared counters and clears its
+    // block for the thread claiming it. The thread's blocks still live are
+    // charged to the shared counters when they are freed, since its id no
+    // longer finds the block.
+    void retireCounters(ThreadCounters& counters) {
+        threadDirectory.remove(counters.threadId, &counters);
+        size_t remote = incomingFreedBytes(counters);
+        if (counters.allocations.load(std::memory_order_relaxed) > 0) {
+            retiredThreads.fetch_add(1, std::memory_order_relaxed);
+        }
+        sharedCounters.allocations.fetch_add(counters.allocations.exchange(0, std::memory_order_relaxed),
+                                             std::memory_order_relaxed);
+        sharedCounters.deallocations.fetch_add(counters.deallocations.exchange(0, std::memory_order_relaxed),
+                                               std::memory_order_relaxed);
+        sharedCounters.allocatedBytes.fetch_add(counters.allocatedBytes.exchange(0, std::memory_order_relaxed),
+                                                std::memory_order_relaxed);
+        sharedCounters.freedBytes.fetch_add(counters.freedBytes.exchange(0, std::memory_order_relaxed) + remote,
+                                            std::memory_order_relaxed);
+        size_t peak = counters.peakBytes.exchange(0, std::memory_order_relaxed);
+        if (peak > sharedCounters.peakBytes.load(std::memory_order_relaxed)) {
+            sharedCounters.peakBytes.store(peak, std::memory_order_relaxed);
+            sharedCounters.peakNanos.store(counters.peakNanos.load(std::memory_order_relaxed),
+                                           std::memory_order_relaxed);
+        }
+        counters.remoteBase.fetch_add(remote, std::memory_order_relaxed);
+        counters.remoteFreedBytes.store(0, std::memory_order_relaxed);
+        counters.peakNanos.store(0, std::memory_order_relaxed);
+    }
+    
+    // Cell of the current thread for frees of blocks owner allocated,
+    // created on first use. A small per-thread cache keyed by the owner's
+    // id saves walking the thread's cells on most frees. NULL when no
+    // memory is left for the cell.
+    RemoteFrees* remoteFreesFor(ThreadCounters& self, ThreadCounters* owner, int ownerId) {
+        static thread_local RemoteFrees* cache[16] = {NULL};
+        RemoteFrees*& cached = cache[static_cast<uint32_t>(ownerId) % 16];
+        if (cached && cached->freer == &self && cached->owner == owner) {
+            return cached;
+        }
+        for (RemoteFrees* cell = self.outgoing.load(std::memory_order_relaxed); cell; cell = cell->nextOutgoing) {
+            if (cell->owner == owner) {
+                cached = cell;
+                return cell;
+            }
+        }
+        void* memory = metaArena.allocate(sizeof(RemoteFrees));
+        if (!memory) {
+            return NULL;
+        }
+        RemoteFrees* cell = ::new (memory) RemoteFrees(owner, &self);
+        cell->nextOutgoing = self.outgoing.load(std::memory_order_relaxed);
+        self.outgoing.store(cell, std::memory_order_release);
+        RemoteFrees* head = owner->incoming.load(std::memory_order_relaxed);
+        do {
+            cell->nextIncoming = head;
+        } while (!owner->incoming.compare_exchange_weak(head, cell, std::memory_order_release,
+                                                        std::memory_order_relaxed));
+        cached = cell;
+        return cell;
+    }
+    
+    // Charges a free to the thread that allocated the block: to the
+    // current thread's own counters when it is the owner, otherwise to
+    // its cell for the owner, so no counter is shared between threads.
+    // Blocks of threads whose counters went to a new thread, and frees
+    // made through the shared counters, are charged to those.
+    void releaseFromOwner(int ownerId, size_t count, size_t bytes) {
+        ThreadCounters& self = threadCounters();
+        if (ownerId == 0 || ownerId == self.threadId) {
+            bump(self.freedBytes, bytes, self.shared);
+            return;
+        }
+        ThreadCounters* owner = threadDirectory.find(ownerId);
+        if (!owner || self.shared) {
+            sharedCounters.freedBytes.fetch_add(bytes, std::memory_order_relaxed);
+            return;
+        }
+        RemoteFrees* cell = owner != &self ? remoteFreesFor(self, owner, ownerId) : NULL;
+        if (!cell) {
+            bump(self.freedBytes, bytes);
+            return;
+        }
+        bump(cell->count, count);
+        bump(cell->bytes, bytes);
+    }
+    
+    // Remote frees can only lower a thread's live bytes, so the owner
+    // adds up its incoming cells only when the count without the ones it
+    // has not seen yet would set a new peak.
+    static void raiseThreadPeak(ThreadCounters& counters, uint64_t nanos) {
+        size_t allocated = counters.allocatedBytes.load(std::memory_order_relaxed);
+        size_t freed = counters.freedBytes.load(std::memory_order_relaxed);
+        size_t peak = counters.peakBytes.load(std::memory_order_relaxed);
+        if (counters.shared || allocated <= freed + counters.remoteFreedBytes.load(std::memory_order_relaxed) + peak) {
+            return;
+        }
+        size_t remote = incomingFreedBytes(counters);
+        counters.remoteFreedBytes.store(remote, std::memory_order_relaxed);
+        if (allocated <= freed + remote + peak) {
+            return;
+        }
+        counters.peakBytes.store(allocated - freed - remote, std::memory_order_relaxed);
+        counters.peakNanos.store(nanos, std::memory_order_relaxed);
+    }
+    
+    static size_t threadLiveBytes(const ThreadCounters& counters) {
+        size_t allocated = counters.allocatedBytes.load(std::memory_order_relaxed);
+        size_t freed = counters.freedBytes.load(std::memory_order_relaxed) + incomingFreedBytes(counters);
+        return allocated > freed ? allocated - freed : 0;
+    }
+    
+    // Counters of a block with a single writer are updated with a plain
+    // store; the shared block has many writers and needs the atomic add.
+    static void bump(std::atomic<size_t>& counter, size_t amount = 1, bool shared = false) {
+        if (shared) {
+            counter.fetch_add(amount, std::memory_order_relaxed);
+        } else {
+            counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+    }
+    
+    // Threads that allocated, counting those whose counters were handed on.
+    size_t threadsThatAllocated() const {
+        size_t threads = retiredThreads.load(std::memory_order_relaxed);
+        for (ThreadCounters* t = threadList.load(std::memory_order_acquire); t; t = t->next) {
+            threads += !t->shared && t->allocations.load(std::memory_order_relaxed) > 0 ? 1 : 0;
+        }
+        return threads;
+    }
+    
+    void countFrees(size_t count) {
+        ThreadCounters& counters = threadCounters();
+        bump(counters.deallocations, count, counters.shared);
+    }
+    
+    static SamplerState& threadSampler() {
+        static thread_local SamplerState sampler = {0, 0, 0};
+        return sampler;
+    }
+    
+    // Inverse probability that an allocation of this size was sampled;
+    // 1 when every allocation is recorded.
+    static double sampleWeight(size_t size, size_t interval) {
+        if (interval == 0) {
+            return 1.0;
+        }
+        double bytes = static_cast<double>(size == 0 ? 1 : size);
+        return 1.0 / -std::expm1(-bytes / static_cast<double>(interval));
+    }
+    
+    size_t estimatedCount(size_t size) const {
+        return static_cast<size_t>(std::llround(sampleWeight(size, samplingInterval.load(std::memory_order_relaxed))));
+    }
+    
+    size_t estimatedBytes(size_t size) const {
+        return static_cast<size_t>(std::llround(size * sampleWeight(size, samplingInterval.load(std::memory_order_relaxed))));
+    }
+    
+    static size_t filterBit(uint64_t hash) {
+        return static_cast<size_t>(hash) & (FILTER_WORDS * 64 - 1);
+    }
+    
+    // Builds the spare filter from the records in the table and makes it
+    // the current one. Every shard stays locked from the walk to the swap,
+    // so a record inserted meanwhile has its bit set after the swap. A
+    // thread still holding the old buffer only sets or reads a stale bit:
+    // the buffer is not cleared before the next rebuild.
+    void rebuildFilter() {
+        if (!filterLock.tryLock()) {
+            return;
+        }
+        if (streaming.load(std::memory_order_acquire) ||
+            filterBitsSet.load(std::memory_order_relaxed) < filterRebuildAt.load(std::memory_order_relaxed)) {
+            filterLock.unlock();
+            return;
+        }
+        std::atomic<uint64_t>* fresh = spareFilter;
+        if (!fresh) {
+            fresh = static_cast<std::atomic<uint64_t>*>(arena.allocate(FILTER_WORDS * sizeof(uint64_t)));
+            if (!fresh) {
+                filterLock.unlock();
+                return;
+            }
+        } else {
+            for (size_t i = 0; i < FILTER_WORDS; i++) {
+                fresh[i].store(0, std::memory_order_relaxed);
+            }
+        }
+        for (size_t s = 0; s < SHARD_COUNT; s++) {
+            shards[s].lock.lock();
+        }
+        size_t set = 0;
+        for (size_t s = 0; s < SHARD_COUNT; s++) {
+            shards[s].table.forEach([fresh, &set](const AllocationInfo& info) {
+                size_t bit = filterBit(hashPointer(info.address));
+                uint64_t mask = uint64_t(1) << (bit % 64);
+                if ((fresh[bit / 64].fetch_or(mask, std::memory_order_relaxed) & mask) == 0) {
+                    set++;
+                }
+            });
+        }
+        spareFilter = sampledFilter.exchange(fresh, std::memory_order_acq_rel);
+        filterBitsSet.store(set, std::memory_order_relaxed);
+        filterRebuildAt.store(set + FILTER_WORDS * 64 / 4, std::memory_order_relaxed);
+        for (size_t s = 0; s < SHARD_COUNT; s++) {
+            shards[s].lock.unlock();
+        }
+        filterLock.unlock();
+    }
+    
+    // Per-thread direct-mapped cache in front of the call site table, so a
+    // hot site is resolved without touching shared state.
+    uint32_t siteIdFor(const CallSiteKey& key) {
+        struct CacheEntry {
+            CallSiteKey key;
+            uint32_t id;
+            uint32_t generation;
+        };
+        static thread_local CacheEntry cache[64];
+        
+        CacheEntry& entry = cache[(key.hash() >> 58) & 63];
+        uint32_t generation = callSites.currentGeneration() + 1;
+        if (!(entry.key == key) || entry.generation != generation) {
+            entry.key = key;
+            entry.id = callSites.intern(key);
+            entry.generation = entry.id == CallSiteTable::NO_ID ? 0 : generation;
+        }
+        return entry.id;
+    }
+    
+    std::string formatWallClock(time_t when) {
+        char buffer[100];
+        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", localtime(&when));
+        return std::string(buffer);
+    }
+    
+    std::string formatTimestamp(uint64_t nanos) {
+        return formatWallClock(startWallClock + static_cast<time_t>((nanos - startNanos) / 1000000000ULL));
+    }
+    
+    std::string getCurrentTimestamp() {
+        return formatWallClock(time(0));
+    }
+    
+    // Names a code address as function+offset (module), falling back to the
+    // module offset or the raw address when no symbol is available.
+    const std::string& symbolize(const void* address) {
+        std::lock_guard<std::mutex> guard(symbolMutex);
+        std::unordered_map<const void*, std::string>::iterator it = symbolCache.find(address);
+        if (it == symbolCache.end()) {
+            it = symbolCache.insert(std::make_pair(address, describeAddress(address))).first;
+        }
+        return it->second;
+    }
+    
+    static std::string describeAddress(const void* address) {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%p", address);
+#ifndef _WIN32
+        Dl_info info;
+        if (dladdr(address, &info) && info.dli_fname) {
+            const char* module = strrchr(info.dli_fname, '/');
+            module = module ? module + 1 : info.dli_fname;
+            if (info.dli_sname) {
+                int status = 0;
+                char* demangled = abi::__cxa_demangle(info.dli_sname, NULL, NULL, &status);
+                std::string name = status == 0 && demangled ? demangled : info.dli_sname;
+                free(demangled);
+                snprintf(buffer, sizeof(buffer), "+0x%lx (",
+                         static_cast<unsigned long>(static_cast<const char*>(address) -
+                                                    static_cast<const char*>(info.dli_saddr)));
+                return name + buffer + module + ")";
+            }
+            snprintf(buffer, sizeof(buffer), "+0x%lx",
+                     static_cast<unsigned long>(static_cast<const char*>(address) -
+                                                static_cast<const char*>(info.dli_fbase)));
+            return module + std::string(buffer);
+        }
+#endif
+        return buffer;
+    }
+    
+    static std::string htmlEscape(const std::string& text) {
+        std::string out;
+        out.reserve(text.size());
+        for (size_t i = 0; i < text.size(); i++) {
+            switch (text[i]) {
+                case '<': out += "&lt;"; break;
+                case '>': out += "&gt;"; break;
+                case '&': out += "&amp;"; break;
+                case '"': out += "&quot;"; break;
+                default: out += text[i]; break;
+            }
+        }
+        return out;
+    }
+    
+    static void writeStackDetails(std::ostream& out, const std::string& stack) {
+        if (!stack.empty()) {
+            out << "<details><summary>stack</summary><pre>" << htmlEscape(stack) << "</pre></details>";
+        }
+    }
+    
+    double secondsSinceStart(uint64_t nanos) const {
+        return nanos > startNanos ? (nanos - startNanos) / 1e9 : 0.0;
+    }
+    
+    // Area chart of the sampled usage as inline SVG, with the peak marked.
+    void writeTimelineChart(std::ostream& out, const std::vector<TimelinePoint>& points) {
+        uint64_t first = points.front().nanos;
+        double span = points.back().nanos > first ? static_cast<double>(points.back().nanos - first) : 1.0;
+        size_t top = peakMemoryUsage.load();
+        for (size_t i = 0; i < points.size(); i++) {
+            top = std::max(top, points[i].bytes);
+        }
+        double scale = top > 0 ? 230.0 / top : 0.0;
+        
+        std::ostringstream line;
+        for (size_t i = 0; i < points.size(); i++) {
+            line << ((points[i].nanos - first) / span * 1000.0) << "," << (250.0 - points[i].bytes * scale) << " ";
+        }
+        out << "        <div class=\"section\"><h2>📉 Memory Usage Over Time</h2>\n";
+        out << "            <svg viewBox=\"0 0 1000 250\" width=\"100%\" height=\"250\" preserveAspectRatio=\"none\">\n";
+        out << "                <polygon fill=\"rgba(102,126,234,0.25)\" points=\"0,250 " << line.str() << "1000,250\"/>\n";
+        out << "                <polyline fill=\"none\" stroke=\"#667eea\" stroke-width=\"2\" points=\"" << line.str()
+            << "\"/>\n";
+        uint64_t peakAt = peakNanos.load();
+        if (peakAt >= first) {
+            double x = (peakAt - first) / span * 1000.0;
+            out << "                <line x1=\"" << x << "\" y1=\"0\" x2=\"" << x
+                << "\" y2=\"250\" stroke=\"#dc3545\" stroke-dasharray=\"6,4\"/>\n";
+        }
+        out << "            </svg>\n";
+        out << "            <p>" << points.size() << " samples from " << secondsSinceStart(first) << " s to "
+            << secondsSinceStart(points.back().nanos) << " s after start; the dashed line marks the peak of "
+            << (peakMemoryUsage.load() / 1024.0) << " KB at " << secondsSinceStart(peakAt) << " s.</p></div>\n";
+    }
+    
+    static std::string formatSize(size_t bytes) {
+        const char* units[] = {"B", "KiB", "MiB", "GiB"};
+        size_t unit = 0;
+        while (unit < 3 && bytes >= 1024 && bytes % 1024 == 0) {
+            bytes /= 1024;
+            unit++;
+        }
+        return std::to_string(bytes) + " " + units[unit];
+    }
+    
+    static std::string formatMicros(uint64_t micros) {
+        if (micros >= 1000000) {
+            return std::to_string(micros / 1000000) + " s";
+        }
+        if (micros >= 1000) {
+            return std::to_string(micros / 1000) + " ms";
+        }
+        return std::to_string(micros) + " us";
+    }
+    
+    static std::string sizeClassLabel(uint32_t k) {
+        if (k == SIZE_CLASSES - 1) {
+            return "&ge; " + formatSize(size_t(1) << k);
+        }
+        return formatSize(size_t(1) << k) + " to &lt; " + formatSize(size_t(1) << (k + 1));
+    }
+    
+    static std::string lifetimeLabel(uint32_t k) {
+        if (k == 0) {
+            return "&lt; 1 us";
+        }
+        if (k == LIFETIME_CLASSES - 1) {
+            return "&ge; " + formatMicros(uint64_t(1) << (2 * (k - 1)));
+        }
+        return "&lt; " + formatMicros(uint64_t(1) << (2 * k));
+    }
+    
+    static void writeHistogramRow(std::ostream& out, const std::string& label, size_t count, size_t total) {
+        double percentage = total > 0 ? count * 100.0 / total : 0.0;
+        out << "                    <tr><td>" << label << "</td><td>" << count << "</td><td>\n";
+        out << "                            <div class=\"progress-bar\" style=\"height: 20px;\">\n";
+        out << "                                <div class=\"progress-fill\" style=\"width: " << percentage
+            << "%; font-size: 0.8em;\">" << percentage << "%</div></div></td></tr>\n";
+    }
+    
+    // Size classes of every allocation and lifetimes of every free, summed
+    // over all sites.
+    void writeSizesAndLifetimes(std::ostream& out) {
+        size_t sizes[SIZE_CLASSES] = {0};
+        size_t lifetimes[LIFETIME_CLASSES] = {0};
+        size_t allocations = 0;
+        size_t frees = 0;
+        for (uint32_t id = 0; id < callSites.size(); id++) {
+            const CallSite& site = callSites.get(id);
+            for (uint32_t k = 0; k < SIZE_CLASSES; k++) {
+                size_t count = site.sizeClasses[k].load(std::memory_order_relaxed);
+                sizes[k] += count;
+                allocations += count;
+            }
+            for (uint32_t k = 0; k < LIFETIME_CLASSES; k++) {
+                size_t count = site.lifetimes[k].load(std::memory_order_relaxed);
+                lifetimes[k] += count;
+                frees += count;
+            }
+        }
+        if (allocations == 0) {
+            return;
+        }
+        
+        out << "        <div class=\"section\"><h2>📦 Allocation Sizes and Lifetimes</h2>\n";
+        out << "            <table><thead><tr><th>Size</th><th>Allocations</th><th>Share</th></tr></thead><tbody>\n";
+        for (uint32_t k = 0; k < SIZE_CLASSES; k++) {
+            if (sizes[k] > 0) {
+                writeHistogramRow(out, sizeClassLabel(k), sizes[k], allocations);
+            }
+        }
+        out << "                </tbody></table>\n";
+        if (frees > 0) {
+            out << "            <table><thead><tr><th>Lifetime</th><th>Frees</th><th>Share</th></tr></thead><tbody>\n";
+            for (uint32_t k = 0; k < LIFETIME_CLASSES; k++) {
+                if (lifetimes[k] > 0) {
+                    writeHistogramRow(out, lifetimeLabel(k), lifetimes[k], frees);
+                }
+            }
+            out << "                </tbody></table>\n";
+        }
+        out << "            </div>\n";
+    }
+    
+    // Bytes glibc malloc spends on a block beyond what was asked for: an
+    // 8-byte header, rounding to 16 and a 32-byte minimum chunk.
+    static size_t mallocOverhead(size_t size) {
+        size_t chunk = (size + 8 + 15) & ~size_t(15);
+        return (chunk < 32 ? 32 : chunk) - size;
+    }
+    
+    // Sites that allocate often and free almost everything within a
+    // millisecond. A pool or arena sized for the site's peak live count
+    // would serve all other allocations and frees without malloc.
+    void writePoolCandidates(std::ostream& out, const std::vector<uint32_t>& rowOf, const std::vector<uint32_t>& rows) {
+        static const size_t MIN_ALLOCATIONS = 1000;
+        static const uint32_t SHORT_LIVED_CLASSES = 6;  // under 1 ms
+        
+        std::vector<size_t> allocations(rows.size());
+        std::vector<size_t> frees(rows.size());
+        std::vector<size_t> shortLived(rows.size());
+        std::vector<size_t> peakLive(rows.size());
+        for (uint32_t id = 0; id < rowOf.size(); id++) {
+            const CallSite& site = callSites.get(id);
+            uint32_t row = rowOf[id];
+            allocations[row] += site.allocations.load(std::memory_order_relaxed);
+            peakLive[row] += site.peakLive.load(std::memory_order_relaxed);
+            for (uint32_t k = 0; k < LIFETIME_CLASSES; k++) {
+                size_t count = site.lifetimes[k].load(std::memory_order_relaxed);
+                frees[row] += count;
+                if (k < SHORT_LIVED_CLASSES) {
+                    shortLived[row] += count;
+                }
+            }
+        }
+        
+        std::vector<size_t> callsSaved(rows.size());
+        std::vector<uint32_t> order;
+        for (uint32_t r = 0; r < rows.size(); r++) {
+            if (allocations[r] >= MIN_ALLOCATIONS && frees[r] * 2 >= allocations[r] &&
+                shortLived[r] * 10 >= frees[r] * 9 && allocations[r] > peakLive[r]) {
+                callsSaved[r] = 2 * (allocations[r] - peakLive[r]);
+                order.push_back(r);
+            }
+        }
+        size_t shown = selectTop(order, callsSaved, reportRows);
+        
+        out << "        <div class=\"section\"><h2>💡 Pool and Arena Candidates</h2>\n";
+        out << "            <p>Sites with at least " << MIN_ALLOCATIONS << " allocations where 90% of frees come within "
+            << "1 ms. Calls saved counts the malloc and free calls beyond the site's peak live count; bytes "
+            << "saved is malloc's per-block overhead at that peak.</p>\n";
+        if (shown == 0) {
+            out << "            <p>No site is both frequent and short-lived enough to benefit from pooling.</p></div>\n";
+            return;
+        }
+        
+        // Size range of the rows shown, merged over their sites.
+        std::unordered_map<uint32_t, std::pair<size_t, size_t> > sizeRange;
+        for (size_t i = 0; i < shown; i++) {
+            sizeRange[order[i]] = std::make_pair(SIZE_MAX, size_t(0));
+        }
+        for (uint32_t id = 0; id < rowOf.size(); id++) {
+            std::unordered_map<uint32_t, std::pair<size_t, size_t> >::iterator it = sizeRange.find(rowOf[id]);
+            if (it != sizeRange.end()) {
+                const CallSite& site = callSites.get(id);
+                it->second.first = std::min(it->second.first, ~site.smallestInverse.load(std::memory_order_relaxed));
+                it->second.second = std::max(it->second.second, site.largest.load(std::memory_order_relaxed));
+            }
+        }
+        
+        out << "            <table><thead><tr><th>Location</th><th>Allocations</th><th>Freed within 1 ms</th>\n";
+        out << "                <th>Peak Live</th><th>Suggestion</th><th>Calls Saved</th><th>Bytes Saved</th></tr></thead><tbody>\n";
+        for (size_t i = 0; i < shown; i++) {
+            uint32_t r = order[i];
+            size_t smallest = sizeRange[r].first;
+            size_t largest = sizeRange[r].second;
+            // One size class fits a pool of fixed slots, counted
+            // conservatively against the smallest block; wider ranges suit
+            // a bump arena, which has no per-block header at all.
+            bool fixedSize = sizeClassOf(smallest) == sizeClassOf(largest);
+            size_t perBlock = 8;
+            if (fixedSize) {
+                size_t mallocCost = smallest + mallocOverhead(smallest);
+                perBlock = mallocCost > largest ? mallocCost - largest : 0;
+            }
+            size_t bytesSaved = peakLive[r] * perBlock;
+            out << "                    <tr><td><code>" << htmlEscape(siteName(rows[r])) << "</code>";
+            writeStackDetails(out, siteStack(rows[r]));
+            out << "</td><td>" << allocations[r] << "</td><td>" << (shortLived[r] * 100.0 / frees[r]) << "%</td><td>"
+                << peakLive[r] << "</td><td>";
+            if (fixedSize) {
+                out << "Object pool of " << largest << "-byte slots";
+            } else {
+                out << "Arena for " << smallest << "&ndash;" << largest << " byte blocks";
+            }
+            out << "</td><td>" << callsSaved[r] << "</td><td>" << (bytesSaved / 1024.0) << " KB</td></tr>\n";
+        }
+        if (shown < order.size()) {
+            out << "                    <tr><td><em>" << (order.size() - shown) << " more sites</em></td>"
+                << "<td></td><td></td><td></td><td></td><td></td><td></td></tr>\n";
+        }
+        out << "                </tbody></table></div>\n";
+    }
+    
+    std::string siteName(uint32_t siteId) {
+        if (siteId == CallSiteTable::NO_ID) {
+            return "unknown";
+        }
+        const CallSiteKey& key = callSites.get(siteId).key;
+        if (key.file) {
+            return std::string(key.file) + ":" + std::to_string(key.line);
+        }
+        if (key.caller) {
+            return symbolize(key.caller);
+        }
+        return "unknown";
+    }
+    
+    // Symbolized frames of the site's stack, one per line; empty when no
+    // stack was captured.
+    std::string siteStack(uint32_t siteId) {
+        std::string text;
+        if (siteId == CallSiteTable::NO_ID) {
+            return text;
+        }
+        uint32_t stackId = callSites.get(siteId).key.stackId;
+        if (stackId == StackTable::NO_ID) {
+            return text;
+        }
+        const StackKey& stack = stacks.get(stackId).key;
+        for (uint32_t i = 0; i < stack.depth; i++) {
+            text += symbolize(stack.frames[i]);
+            text += "\n";
+        }
+        return text;
+    }
+    
+    // Frames of a call site for the exports, innermost first. The file and
+    // line from the `new` macro belong to the innermost frame.
+    void siteFrames(uint32_t siteId, std::vector<ProfileFrame>& frames) {
+        frames.clear();
+        const CallSiteKey& key = callSites.get(siteId).key;
+        if (key.stackId != StackTable::NO_ID) {
+            const StackKey& stack = stacks.get(key.stackId).key;
+            for (uint32_t i = 0; i < stack.depth; i++) {
+                frames.push_back(frameFromSymbol(symbolize(stack.frames[i]),
+                                                 reinterpret_cast<uintptr_t>(stack.frames[i])));
+            }
+        } else if (key.caller) {
+            frames.push_back(frameFromSymbol(symbolize(key.caller), reinterpret_cast<uintptr_t>(key.caller)));
+        }
+        if (key.file) {
+            if (frames.empty()) {
+                ProfileFrame frame = {key.file, "", 0, 0};
+                frames.push_back(frame);
+            }
+            frames[0].file = key.file;
+            frames[0].line = key.line;
+        }
+        if (frames.empty()) {
+            ProfileFrame frame = {"unknown", "", 0, 0};
+            frames.push_back(frame);
+        }
+    }
+    
+    void siteValues(const CallSite& site, int64_t* values) const {
+        values[0] = static_cast<int64_t>(site.allocations.load(std::memory_order_relaxed));
+        values[1] = static_cast<int64_t>(site.allocatedBytes.load(std::memory_order_relaxed));
+        values[2] = static_cast<int64_t>(site.liveCount.load(std::memory_order_relaxed));
+        values[3] = static_cast<int64_t>(site.liveBytes.load(std::memory_order_relaxed));
+    }
+
+    static const uint32_t MAX_STACK_DEPTH = 64;
+    // Extra frames captured so the profiler's own frames can be cut off.
+    static const uint32_t STACK_SLACK = 8;
+    
+    // Captures the current stack starting at the frame that returns to
+    // caller and interns it. A per-thread cache maps a stack's hash to its
+    // id, so a stack seen before costs one hash and one comparison.
+    uint32_t captureStackId(const void* caller, uint32_t depth) {
+        const void* frames[MAX_STACK_DEPTH + STACK_SLACK];
+        uint32_t captured = captureStack(frames, depth + STACK_SLACK,
+                                         static_cast<StackUnwinder>(stackUnwinder.load(std::memory_order_relaxed)));
+        uint32_t first = 0;
+        if (caller) {
+            while (first < captured && first < STACK_SLACK && frames[first] != caller) {
+                first++;
+            }
+            if (first == captured || first == STACK_SLACK) {
+                // The walk never got past the profiler's own frames; the
+                // caller is the one frame known to be right.
+                first = 0;
+                frames[0] = caller;
+                captured = 1;
+            }
+        }
+        uint32_t count = captured - first < depth ? captured - first : depth;
+        if (count == 0) {
+            return StackTable::NO_ID;
+        }
+        
+        StackKey key = {frames + first, count, StackKey::hashFrames(frames + first, count)};
+        struct CacheEntry {
+            uint64_t hash;
+            uint32_t id;
+            uint32_t generation;
+        };
+        static thread_local CacheEntry cache[256];
+        
+        CacheEntry& entry = cache[key.hashValue >> 56];
+        uint32_t generation = stacks.currentGeneration() + 1;
+        if (entry.hash == key.hashValue && entry.generation == generation && stacks.get(entry.id).key == key) {
+            return entry.id;
+        }
+        uint32_t id = stacks.intern(key);
+        entry.hash = key.hashValue;
+        entry.id = id;
+        entry.generation = id == StackTable::NO_ID ? 0 : generation;
+        return id;
+    }
+    
+    static bool largerAllocation(const AllocationInfo& a, const AllocationInfo& b) {
+        return a.size > b.size;
+    }
+    
+    // Assigns every call site a report row. Sites naming the same file and
+    // line are merged, since one file can be reached through different
+    // __FILE__ literals; otherwise the site key is already unique. rows[i]
+    // holds the first site id of row i.
+    void groupSites(std::vector<uint32_t>& rowOf, std::vector<uint32_t>& rows) {
+        size_t count = callSites.size();
+        rowOf.resize(count);
+        std::unordered_map<std::string, uint32_t> byLocation;
+        for (uint32_t id = 0; id < count; id++) {
+            const CallSiteKey& key = callSites.get(id).key;
+            uint32_t row = static_cast<uint32_t>(rows.size());
+            if (key.file) {
+                std::string location = std::string(key.file) + ":" + std::to_string(key.line) + "#" +
+                                       std::to_string(key.stackId);
+                row = byLocation.insert(std::make_pair(location, row)).first->second;
+            }
+            if (row == rows.size()) {
+                rows.push_back(id);
+            }
+            rowOf[id] = row;
+        }
+    }
+    
+    // Moves the `limit` rows with the largest values to the front in
+    // descending order and returns how many that is.
+    template <typename Value>
+    static size_t selectTop(std::vector<uint32_t>& order, const std::vector<Value>& values, size_t limit) {
+        size_t count = order.size() < limit ? order.size() : limit;
+        std::partial_sort(order.begin(), order.begin() + count, order.end(),
+                          [&values](uint32_t a, uint32_t b) { return values[a] > values[b]; });
+        return count;
+    }
+    
+    // Adds a pending entry to its site and empties it. peakLive becomes at
+    // least the site's live count here plus the entry's high mark, so a
+    // peak that only shows when several threads' pending counts are summed
+    // is missed.
+    void addPending(PendingSite& entry) {
+        uint32_t siteId = entry.siteId - 1;
+        if (siteId < callSites.size()) {
+            CallSite& site = callSites.get(siteId);
+            site.allocations.fetch_add(entry.allocations, std::memory_order_relaxed);
+            site.allocatedBytes.fetch_add(entry.allocatedBytes, std::memory_order_relaxed);
+            size_t live = site.liveCount.fetch_add(static_cast<size_t>(entry.liveCount), std::memory_order_relaxed);
+            if (entry.liveHigh > 0) {
+                raiseTo(site.peakLive, live + static_cast<size_t>(entry.liveHigh));
+            }
+            site.liveBytes.fetch_add(static_cast<size_t>(entry.liveBytes), std::memory_order_relaxed);
+            for (uint32_t k = 0; k < SIZE_CLASSES; k++) {
+                if (entry.sizeClasses[k] != 0) {
+                    site.sizeClasses[k].fetch_add(entry.sizeClasses[k], std::memory_order_relaxed);
+                }
+            }
+            for (uint32_t k = 0; k < LIFETIME_CLASSES; k++) {
+                if (entry.lifetimes[k] != 0) {
+                    site.lifetimes[k].fetch_add(entry.lifetimes[k], std::memory_order_relaxed);
+                }
+            }
+        }
+        memset(&entry, 0, sizeof(entry));
+    }
+    
+    // The batch entry for siteId, after adding in the site that held the
+    // slot. Called with the batch locked.
+    PendingSite& pendingSite(SiteBatch& batch, uint32_t siteId) {
+        PendingSite& entry = batch.slots[siteId % SiteBatch::SLOTS];
+        if (entry.siteId != siteId + 1) {
+            if (entry.siteId != 0) {
+                addPending(entry);
+            }
+            entry.siteId = siteId + 1;
+        }
+        return entry;
+    }
+    
+    // Adds every thread's pending site counts in, or throws them away when
+    // the sites themselves are being forgotten.
+    void flushSiteBatches(bool discard = false) {
+        for (ThreadCounters* t = threadList.load(std::memory_order_acquire); t; t = t->next) {
+            SiteBatch* batch = t->sites;
+            if (!batch) {
+                continue;
+            }
+            batch->lock.lock();
+            for (size_t i = 0; i < SiteBatch::SLOTS; i++) {
+                if (discard) {
+                    memset(&batch->slots[i], 0, sizeof(PendingSite));
+                } else if (batch->slots[i].siteId != 0) {
+                    addPending(batch->slots[i]);
+                }
+            }
+            batch->lock.unlock();
+        }
+    }
+    
+    // Copies every site's live totals unless an equal or higher snapshot
+    // exists; another thread already copying wins.
+    void snapshotPeak(size_t usage, uint64_t nanos) {
+        if (!peakLock.tryLock()) {
+            return;
+        }
+        if (usage <= peakSnapshotBytes) {
+            peakLock.unlock();
+            return;
+        }
+        flushSiteBatches();
+        size_t count = callSites.size();
+        peakSites.resize(count);
+        for (uint32_t id = 0; id < count; id++) {
+            const CallSite& site = callSites.get(id);
+            peakSites[id].count = site.liveCount.load(std::memory_order_relaxed);
+            peakSites[id].bytes = site.liveBytes.load(std::memory_order_relaxed);
+        }
+        peakSnapshotBytes = usage;
+        peakSnapshotNanos = nanos;
+        nextPeakSnapshot.store(usage + std::max(usage / 16, size_t(64) << 10), std::memory_order_relaxed);
+        peakLock.unlock();
+    }
+    
+    // Takes a record that left the table out of the usage totals; a block
+    // freed at freedAt also counts towards its site's lifetime histogram.
+    void releaseLive(const AllocationInfo& info, uint64_t freedAt) {
+        size_t count = estimatedCount(info.size);
+        size_t bytes = estimatedBytes(info.size);
+        currentMemoryUsage.fetch_sub(bytes, std::memory_order_relaxed);
+        releaseFromOwner(info.threadId, count, bytes);
+        if (info.siteId >= callSites.size()) {
+            return;
+        }
+        uint32_t lifetimeClass = LIFETIME_CLASSES;
+        if (freedAt != 0) {
+            lifetimeClass = lifetimeClassOf(freedAt > info.timestamp ? freedAt - info.timestamp : 0);
+        }
+        SiteBatch* batch = threadCounters().sites;
+        if (batch) {
+            batch->lock.lock();
+            PendingSite& entry = pendingSite(*batch, info.siteId);
+            entry.liveCount -= static_cast<int64_t>(count);
+            entry.liveBytes -= static_cast<int64_t>(bytes);
+            if (lifetimeClass < LIFETIME_CLASSES) {
+                entry.lifetimes[lifetimeClass] += count;
+            }
+            batch->lock.unlock();
+            return;
+        }
+        CallSite& site = callSites.get(info.siteId);
+        site.liveCount.fetch_sub(count, std::memory_order_relaxed);
+        site.liveBytes.fetch_sub(bytes, std::memory_order_relaxed);
+        if (lifetimeClass < LIFETIME_CLASSES) {
+            site.lifetimes[lifetimeClass].fetch_add(count, std::memory_order_relaxed);
+        }
+    }
+    
+    // Raises the peak to usage, the live bytes just after an allocation,
+    // and copies the site totals when it has grown far enough.
+    void checkPeak(size_t usage, uint64_t nanos) {
+        size_t peak = peakMemoryUsage.load(std::memory_order_relaxed);
+        while (usage > peak && !peakMemoryUsage.compare_exchange_weak(peak, usage, std::memory_order_relaxed)) {
+        }
+        if (usage > peak) {
+            peakNanos.store(nanos, std::memory_order_relaxed);
+            if (usage >= nextPeakSnapshot.load(std::memory_order_relaxed)) {
+                snapshotPeak(usage, nanos);
+            }
+        }
+    }
+    
+    size_t currentUsage() const { return currentMemoryUsage.load(std::memory_order_relaxed); }
+    
+    void addTimelinePointLocked(uint64_t nanos, size_t bytes) {
+        if (timelineSkip == 0 || bytes >= timelinePending.bytes) {
+            timelinePending.nanos = nanos;
+            timelinePending.bytes = bytes;
+        }
+        if (++timelineSkip < timelineStride) {
+            return;
+        }
+        timelineSkip = 0;
+        if (timelineSize == TIMELINE_POINTS) {
+            for (size_t i = 0; i < TIMELINE_POINTS / 2; i++) {
+                const TimelinePoint& a = timeline[2 * i];
+                const TimelinePoint& b = timeline[2 * i + 1];
+                timeline[i] = a.bytes >= b.bytes ? a : b;
+            }
+            timelineSize = TIMELINE_POINTS / 2;
+            timelineStride *= 2;
+        }
+        timeline[timelineSize++] = timelinePending;
+    }
+    
+    void timelineLoop() {
+        enterProfilerThread();
+        std::unique_lock<std::mutex> lock(timelineMutex);
+        while (!stopTimeline) {
+            timelineWake.wait_for(lock, std::chrono::milliseconds(timelineInterval.load()));
+            if (stopTimeline) {
+                break;
+            }
+            uint64_t now = monotonicNanos();
+            size_t usage = currentUsage();
+            addTimelinePointLocked(now, usage);
+            refreshPeakSnapshot(usage, now);
+        }
+    }
+    
+    // Catches the top of a peak the growth threshold stepped over, while
+    // usage is still within 1/32 of it.
+    void refreshPeakSnapshot(size_t usage, uint64_t now) {
+        if (usage > 0 && usage >= peakMemoryUsage.load(std::memory_order_relaxed) / 32 * 31) {
+            snapshotPeak(usage, now);
+        }
+    }
+    
+    static size_t firstOverwrittenByte(const void* block, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(block);
+        uint64_t pattern;
+        memset(&pattern, POISON_BYTE, sizeof(pattern));
+        size_t i = 0;
+        for (; i + sizeof(pattern) <= size; i += sizeof(pattern)) {
+            uint64_t word;
+            memcpy(&word, bytes + i, sizeof(word));
+            if (word != pattern) {
+                break;
+            }
+        }
+        for (; i < size; i++) {
+            if (bytes[i] != POISON_BYTE) {
+                return i;
+            }
+        }
+        return size;
+    }
+    
+    void addHeapError(HeapErrorType type, const AllocationInfo& block, AllocationKind freedAs, const void* caller,
+                      size_t offset) {
+        heapErrorCounts[type].fetch_add(1, std::memory_order_relaxed);
+        heapErrorLock.lock();
+        if (heapErrorLog && heapErrorsLogged < MAX_HEAP_ERRORS) {
+            HeapError error = {type, block, freedAs, caller, offset, monotonicNanos(), currentThreadId()};
+            heapErrorLog[heapErrorsLogged++] = error;
+        }
+        heapErrorLock.unlock();
+    }
+    
+    void evictOldestLocked() {
+        AllocationInfo block = quarantine[quarantineHead];
+        quarantineHead = (quarantineHead + 1) % quarantineCapacity;
+        quarantineCount--;
+        quarantineBytes -= block.size;
+        quarantined.erase(block.address, hashPointer(block.address), NULL);
+        size_t offset = firstOverwrittenByte(block.address, block.size);
+        if (offset < block.size) {
+            addHeapError(WRITE_AFTER_FREE, block, ALLOC_PLAIN, NULL, offset);
+        }
+        releaseBlock(block.address);
+    }
+    
+    // Poisons a freed block and holds it, making room by releasing the
+    // oldest blocks. Returns false if the caller must release it instead.
+    bool enterQuarantine(const AllocationInfo& block) {
+        if (block.size > quarantineBudget.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        memset(block.address, POISON_BYTE, block.size);
+        quarantineLock.lock();
+        if (!quarantine || block.size > quarantineLimit) {
+            quarantineLock.unlock();
+            return false;
+        }
+        while (quarantineCount > 0 &&
+               (quarantineCount == quarantineCapacity || quarantineBytes + block.size > quarantineLimit)) {
+            evictOldestLocked();
+        }
+        bool held = quarantined.insert(block, hashPointer(block.address), NULL);
+        if (held) {
+            quarantine[(quarantineHead + quarantineCount) % quarantineCapacity] = block;
+            quarantineCount++;
+            quarantineBytes += block.size;
+        }
+        quarantineLock.unlock();
+        return held;
+    }
+    
+    // A free of a pointer the table does not know: a double free while the
+    // block waits in the quarantine, otherwise an invalid free, unless the
+    // table may be missing blocks. Returns true if it was reported, in which
+    // case the pointer must not reach the allocator.
+    bool reportUnknownFree(void* ptr, uint64_t hash, AllocationKind kind, const void* caller) {
+        AllocationInfo block = {ptr, 0, 0, CallSiteTable::NO_ID, 0, ALLOC_PLAIN};
+        quarantineLock.lock();
+        const AllocationInfo* held = quarantined.find(ptr, hash);
+        if (held) {
+            block = *held;
+        }
+        quarantineLock.unlock();
+        if (held) {
+            addHeapError(DOUBLE_FREE, block, kind, caller, 0);
+            return true;
+        }
+        if (tableForgotten || droppedRecords.load(std::memory_order_relaxed) != 0 ||
+            samplingInterval.load(std::memory_order_relaxed) != 0) {
+            return false;
+        }
+        addHeapError(INVALID_FREE, block, kind, caller, 0);
+        return true;
+    }
+    
+    // Reports writes to blocks still in the quarantine and poisons them
+    // again, so each write is reported once.
+    void checkQuarantine() {
+        quarantineLock.lock();
+        for (size_t i = 0; i < quarantineCount; i++) {
+            const AllocationInfo& block = quarantine[(quarantineHead + i) % quarantineCapacity];
+            size_t offset = firstOverwrittenByte(block.address, block.size);
+            if (offset < block.size) {
+                addHeapError(WRITE_AFTER_FREE, block, ALLOC_PLAIN, NULL, offset);
+                memset(block.address, POISON_BYTE, block.size);
+            }
+        }
+        quarantineLock.unlock();
+    }
+    
+    size_t heapErrorTotal() const {
+        size_t total = 0;
+        for (size_t t = 0; t < HEAP_ERROR_TYPES; t++) {
+            total += heapErrorCounts[t].load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+    
+    static const char* heapErrorLabel(HeapErrorType type) {
+        switch (type) {
+            case DOUBLE_FREE: return "Double free";
+            case INVALID_FREE: return "Invalid free";
+            case MISMATCHED_FREE: return "Mismatched free";
+            case WRITE_AFTER_FREE: return "Write after free";
+            default: return "Unknown";
+        }
+    }
+    
+    static const char* kindLabel(unsigned kind) {
+        switch (kind) {
+            case ALLOC_NEW: return "new";
+            case ALLOC_NEW_ARRAY: return "new[]";
+            default: return "malloc";
+        }
+    }
+    
+    void writeHeapErrors(std::ostream& out) {
+        if (quarantineBudget.load() == 0 && heapErrorTotal() == 0) {
+            return;
+        }
+        out << "        <div class=\"section\"><h2>🛡️ Heap Errors</h2>\n";
+        size_t budget = quarantineBudget.load();
+        out << "            <p>Quarantine: " << (budget ? formatSize(budget) : std::string("off"));
+        for (size_t t = 0; t < HEAP_ERROR_TYPES; t++) {
+            out << " &middot; " << heapErrorLabel(static_cast<HeapErrorType>(t)) << ": " << heapErrorCounts[t].load();
+        }
+        out << "</p>\n";
+        
+        heapErrorLock.lock();
+        size_t shown = std::min(heapErrorsLogged, reportRows);
+        std::vector<HeapError> errors(heapErrorLog, heapErrorLog + shown);
+        heapErrorLock.unlock();
+        if (errors.empty()) {
+            out << "        </div>\n";
+            return;
+        }
+        out << "            <table><thead><tr><th>Error</th><th>Block</th><th>Allocated At</th><th>Freed By</th>"
+            << "<th>Thread</th><th>Time</th></tr></thead><tbody>\n";
+        for (size_t i = 0; i < errors.size(); i++) {
+            const HeapError& error = errors[i];
+            out << "                    <tr><td><span class=\"badge badge-danger\">" << heapErrorLabel(error.type)
+                << "</span>";
+            if (error.type == MISMATCHED_FREE) {
+                out << " " << kindLabel(error.block.kind) << " freed with " << (error.freedAs == ALLOC_NEW ? "delete" : "delete[]");
+            } else if (error.type == WRITE_AFTER_FREE) {
+                out << " at byte " << error.offset;
+            }
+            out << "</td><td><code>" << error.block.address << "</code>";
+            if (error.block.size > 0) {
+                out << " (" << error.block.size << " bytes, " << kindLabel(error.block.kind) << ")";
+            }
+            out << "</td><td><code>" << htmlEscape(siteName(error.block.siteId)) << "</code>";
+            writeStackDetails(out, siteStack(error.block.siteId));
+            out << "</td><td><code>" << (error.caller ? htmlEscape(symbolize(error.caller)) : std::string("-"))
+                << "</code></td><td>" << error.threadId << "</td><td>" << formatTimestamp(error.nanos) << "</td></tr>\n";
+        }
+        out << "                </tbody></table></div>\n";
+    }
+    
+    // Per-thread totals, added up here from each thread's counters and
+    // incoming cells, and a matrix of who freed whose memory. Threads that
+    // only freed are left out of the table but not of the matrix; exited
+    // threads whose counters went to a new thread share one row.
+    void writeThreadSections(std::ostream& out) {
+        static const size_t MATRIX_THREADS = 12;
+        if (!Policy::leakTracking || !Policy::threadIds) {
+            return;
+        }
+        std::vector<ThreadCounters*> threads;
+        std::vector<size_t> peaks;
+        std::vector<size_t> crossBytes;
+        std::unordered_map<ThreadCounters*, uint32_t> indexOf;
+        size_t remoteCount = 0;
+        size_t remoteBytes = 0;
+        for (ThreadCounters* t = threadList.load(std::memory_order_acquire); t; t = t->next) {
+            indexOf[t] = static_cast<uint32_t>(threads.size());
+            threads.push_back(t);
+            peaks.push_back(t->peakBytes.load(std::memory_order_relaxed));
+            crossBytes.push_back(0);
+        }
+        for (size_t i = 0; i < threads.size(); i++) {
+            for (RemoteFrees* cell = threads[i]->outgoing.load(std::memory_order_acquire); cell;
+                 cell = cell->nextOutgoing) {
+                size_t bytes = cell->bytes.load(std::memory_order_relaxed);
+                remoteCount += cell->count.load(std::memory_order_relaxed);
+                remoteBytes += bytes;
+                crossBytes[i] += bytes;
+                std::unordered_map<ThreadCounters*, uint32_t>::iterator owner = indexOf.find(cell->owner);
+                if (owner != indexOf.end()) {
+                    crossBytes[owner->second] += bytes;
+                }
+            }
+        }
+        std::vector<uint32_t> order;
+        for (uint32_t i = 0; i < threads.size(); i++) {
+            if (threads[i]->allocations.load(std::memory_order_relaxed) > 0) {
+                order.push_back(i);
+            }
+        }
+        if (order.size() < 2 && remoteCount == 0) {
+            return;
+        }
+        size_t shown = selectTop(order, peaks, reportRows);
+        
+        out << "        <div class=\"section\"><h2>🧵 Threads</h2>\n";
+        out << "            <p>" << threadsThatAllocated() << " threads allocated; " << remoteCount << " frees ("
+            << (remoteBytes / 1024.0) << " KB) released a block another thread allocated. Bytes are those of each "
+            << "thread's own allocations, whichever thread freed them.</p>\n";
+        out << "            <table><thead><tr><th>Thread</th><th>Allocations</th><th>Allocated</th><th>Frees Made</th>"
+            << "<th>Freed by Others</th><th>Live</th><th>Peak Live</th></tr></thead><tbody>\n";
+        for (size_t i = 0; i < shown; i++) {
+            const ThreadCounters& t = *threads[order[i]];
+            out << "                    <tr><td>";
+            if (t.shared) {
+                out << "exited threads";
+            } else {
+                out << t.threadId;
+            }
+            out << "</td><td>" << t.allocations.load() << "</td><td>"
+                << (t.allocatedBytes.load() / 1024.0) << " KB</td><td>" << t.deallocations.load() << "</td><td>"
+                << (incomingFreedBytes(t) / 1024.0) << " KB</td><td>" << (threadLiveBytes(t) / 1024.0)
+                << " KB</td><td>" << (t.peakBytes.load() / 1024.0) << " KB</td></tr>\n";
+        }
+        out << "                </tbody></table>\n";
+        
+        std::vector<uint32_t> matrix;
+        for (uint32_t i = 0; i < threads.size(); i++) {
+            if (crossBytes[i] > 0) {
+                matrix.push_back(i);
+            }
+        }
+        size_t size = selectTop(matrix, crossBytes, MATRIX_THREADS);
+        if (size == 0) {
+            out << "            </div>\n";
+            return;
+        }
+        matrix.resize(size);
+        out << "            <h3>Cross-Thread Frees</h3>\n";
+        out << "            <p>Bytes allocated by the thread of each row and freed by the thread of each column, "
+            << "with the number of frees; the " << size << " threads with the most cross-thread traffic.</p>\n";
+        out << "            <table><thead><tr><th>Allocated by &darr; Freed by &rarr;</th>";
+        for (size_t c = 0; c < size; c++) {
+            out << "<th>" << threads[matrix[c]]->threadId << "</th>";
+        }
+        out << "</tr></thead><tbody>\n";
+        for (size_t r = 0; r < size; r++) {
+            ThreadCounters* owner = threads[matrix[r]];
+            out << "                    <tr><th>" << owner->threadId << "</th>";
+            for (size_t c = 0; c < size; c++) {
+                const RemoteFrees* found = NULL;
+                for (RemoteFrees* cell = threads[matrix[c]]->outgoing.load(std::memory_order_acquire);
+                     cell && !found; cell = cell->nextOutgoing) {
+                    if (cell->owner == owner) {
+                        found = cell;
+                    }
+                }
+                if (found && found->count.load() > 0) {
+                    out << "<td>" << (found->bytes.load() / 1024.0) << " KB (" << found->count.load() << ")</td>";
+                } else {
+                    out << "<td>-</td>";
+                }
+            }
+            out << "</tr>\n";
+        }
+        out << "                </tbody></table></div>\n";
+    }
+    
+    void currentSiteTotals(std::vector<LeakTotals>& totals) {
+        flushSiteBatches();
+        size_t count = callSites.size();
+        totals.resize(count);
+        for (uint32_t id = 0; id < count; id++) {
+            const CallSite& site = callSites.get(id);
+            totals[id].count = site.liveCount.load(std::memory_order_relaxed);
+            totals[id].bytes = site.liveBytes.load(std::memory_order_relaxed);
+        }
+    }
+    
+    const HeapSnapshot* findSnapshotLocked(const std::string& name) const {
+        for (size_t i = snapshots.size(); i-- > 0;) {
+            if (snapshots[i].name == name) {
+                return &snapshots[i];
+            }
+        }
+        return NULL;
+    }
+    
+    // Rows whose live totals changed between two sets of per-site totals,
+    // largest growth first. A row is new when it had nothing live before.
+    static void diffSiteTotals(const std::vector<LeakTotals>& from, const std::vector<LeakTotals>& to,
+                               const std::vector<uint32_t>& rowOf, size_t rowCount, std::vector<SiteDelta>& deltas) {
+        std::vector<SiteDelta> rows(rowCount);
+        std::vector<size_t> before(rowCount);
+        for (uint32_t id = 0; id < rowOf.size(); id++) {
+            LeakTotals a = id < from.size() ? from[id] : LeakTotals();
+            LeakTotals b = id < to.size() ? to[id] : LeakTotals();
+            SiteDelta& row = rows[rowOf[id]];
+            row.count += static_cast<long long>(b.count) - static_cast<long long>(a.count);
+            row.bytes += static_cast<long long>(b.bytes) - static_cast<long long>(a.bytes);
+            before[rowOf[id]] += a.count;
+        }
+        for (uint32_t r = 0; r < rowCount; r++) {
+            if (rows[r].count != 0 || rows[r].bytes != 0) {
+                rows[r].row = r;
+                rows[r].added = before[r] == 0;
+                deltas.push_back(rows[r]);
+            }
+        }
+        std::sort(deltas.begin(), deltas.end(),
+                  [](const SiteDelta& a, const SiteDelta& b) { return a.bytes > b.bytes; });
+    }
+    
+    // Diff of two snapshots by report row; an empty `to` means the heap as
+    // it is now. Returns false if a snapshot is unknown.
+    bool diffSnapshots(const std::string& from, const std::string& to, std::vector<uint32_t>& rowOf,
+                       std::vector<uint32_t>& rows, std::vector<SiteDelta>& deltas, double& seconds) {
+        std::vector<LeakTotals> now;
+        if (to.empty()) {
+            currentSiteTotals(now);
+        }
+        std::lock_guard<std::mutex> guard(snapshotMutex);
+        const HeapSnapshot* first = findSnapshotLocked(from);
+        const HeapSnapshot* second = to.empty() ? NULL : findSnapshotLocked(to);
+        if (!first || (!to.empty() && !second)) {
+            return false;
+        }
+        groupSites(rowOf, rows);
+        diffSiteTotals(first->sites, second ? second->sites : now, rowOf, rows.size(), deltas);
+        uint64_t end = second ? second->nanos : monotonicNanos();
+        seconds = end > first->nanos ? (end - first->nanos) / 1e9 : 0.0;
+        return true;
+    }
+    
+    // Live allocations made before `cutoff`, totalled by report row, with
+    // one extra row for allocations without a site.
+    void totalsMadeBefore(uint64_t cutoff, const std::vector<uint32_t>& rowOf, size_t rowCount,
+                          std::vector<LeakTotals>& totals) {
+        totals.assign(rowCount + 1, LeakTotals());
+        for (size_t s = 0; s < SHARD_COUNT; s++) {
+            AllocationShard& shard = shards[s];
+            shard.lock.lock();
+            shard.table.forEach([&](const AllocationInfo& info) {
+                if (info.timestamp < cutoff) {
+                    LeakTotals& row = totals[info.siteId < rowOf.size() ? rowOf[info.siteId] : rowCount];
+                    row.count += estimatedCount(info.size);
+                    row.bytes += estimatedBytes(info.size);
+                }
+            });
+            shard.lock.unlock();
+        }
+    }
+    
+    // Time of the snapshot taken `count` snapshots ago, or 0 if there have
+    // not been that many.
+    uint64_t snapshotCutoff(size_t count) {
+        std::lock_guard<std::mutex> guard(snapshotMutex);
+        if (count == 0 || count > snapshots.size()) {
+            return 0;
+        }
+        return snapshots[snapshots.size() - count].nanos;
+    }
+    
+    void writeSnapshotSections(std::ostream& out) {
+        std::string from;
+        std::string to;
+        {
+            std::lock_guard<std::mutex> guard(snapshotMutex);
+            if (snapshots.size() < 2) {
+                return;
+            }
+            from = snapshots[snapshots.size() - 2].name;
+            to = snapshots.back().name;
+        }
+        std::vector<uint32_t> rowOf;
+        std::vector<uint32_t> rows;
+        std::vector<SiteDelta> deltas;
+        double seconds = 0;
+        if (!diffSnapshots(from, to, rowOf, rows, deltas, seconds)) {
+            return;
+        }
+        
+        size_t shown = std::min(deltas.size(), reportRows);
+        out << "        <div class=\"section\">\n";
+        out << "            <h2>📸 Heap Diff: " << htmlEscape(from) << " &rarr; " << htmlEscape(to) << "</h2>\n";
+        out << "            <p>Change in live allocations by site over " << seconds << " s.</p>\n";
+        out << "            <table><thead><tr><th>Location</th><th>Allocations</th><th>Memory</th></tr></thead><tbody>\n";
+        for (size_t i = 0; i < shown; i++) {
+            const SiteDelta& delta = deltas[i];
+            out << "                    <tr><td><code>" << htmlEscape(siteName(rows[delta.row])) << "</code>";
+            if (delta.added) {
+                out << " <span class=\"badge badge-warning\">new</span>";
+            }
+            writeStackDetails(out, siteStack(rows[delta.row]));
+            out << "</td><td>" << std::showpos << delta.count << "</td><td>" << (delta.bytes / 1024.0)
+                << std::noshowpos << " KB</td></tr>\n";
+        }
+        if (shown < deltas.size()) {
+            out << "                    <tr><td><em>" << (deltas.size() - shown) << " more sites</em></td><td></td><td></td></tr>\n";
+        }
+        out << "                </tbody></table></div>\n";
+        
+        std::string oldest;
+        uint64_t cutoff = 0;
+        size_t outlived = survivorSnapshots;
+        {
+            std::lock_guard<std::mutex> guard(snapshotMutex);
+            if (outlived == 0 || outlived > snapshots.size()) {
+                return;
+            }
+            oldest = snapshots[snapshots.size() - outlived].name;
+            cutoff = snapshots[snapshots.size() - outlived].nanos;
+        }
+        std::vector<LeakTotals> survivors;
+        totalsMadeBefore(cutoff, rowOf, rows.size(), survivors);
+        std::vector<size_t> bytes(survivors.size());
+        std::vector<uint32_t> order;
+        for (uint32_t r = 0; r < survivors.size(); r++) {
+            bytes[r] = survivors[r].bytes;
+            if (survivors[r].count > 0) {
+                order.push_back(r);
+            }
+        }
+        shown = selectTop(order, bytes, reportRows);
+        out << "        <div class=\"section\">\n";
+        out << "            <h2>⏳ Outlived the Last " << outlived << " Snapshots</h2>\n";
+        out << "            <p>Allocations made before " << htmlEscape(oldest) << " that are still live.</p>\n";
+        out << "            <table><thead><tr><th>Location</th><th>Allocations</th><th>Memory</th></tr></thead><tbody>\n";
+        for (size_t i = 0; i < shown; i++) {
+            uint32_t siteId = order[i] < rows.size() ? rows[order[i]] : CallSiteTable::NO_ID;
+            out << "                    <tr><td><code>" << htmlEscape(siteName(siteId)) << "</code>";
+            writeStackDetails(out, siteStack(siteId));
+            out << "</td><td>" << survivors[order[i]].count << "</td><td>" << (survivors[order[i]].bytes / 1024.0)
+                << " KB</td></tr>\n";
+        }
+        out << "                </tbody></table></div>\n";
+    }
+    
+    static std::string jsonEscape(const std::string& text) {
+        std::string out;
+        out.reserve(text.size() + 2);
+        for (size_t i = 0; i < text.size(); i++) {
+            unsigned char c = static_cast<unsigned char>(text[i]);
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += static_cast<char>(c);
+            } else if (c == '\n') {
+                out += "\\n";
+            } else if (c < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            } else {
+                out += static_cast<char>(c);
+            }
+        }
+        return out;
+    }
+    
+    // Counts, per site, how many scans in a row its live bytes have grown
+    // and from where. A site that keeps growing is a leak candidate without
+    // the allocation table ever being walked.
+    void trackGrowthLocked() {
+        flushSiteBatches();
+        size_t count = callSites.size();
+        lastLiveBytes.resize(count, 0);
+        growthStart.resize(count, 0);
+        growthStreak.resize(count, 0);
+        for (uint32_t id = 0; id < count; id++) {
+            size_t live = callSites.get(id).liveBytes.load(std::memory_order_relaxed);
+            if (live > lastLiveBytes[id]) {
+                if (growthStreak[id] == 0) {
+                    growthStart[id] = lastLiveBytes[id];
+                }
+                growthStreak[id]++;
+            } else {
+                growthStreak[id] = 0;
+            }
+            lastLiveBytes[id] = live;
+        }
+    }
+    
+    // "snapshot NAME" takes a snapshot; "diff FROM [TO]" compares two, or
+    // one against the heap now.
+    std::string snapshotJson(const std::string& command, std::istringstream& words) {
+        std::string from;
+        std::string to;
+        words >> from >> to;
+        if (from.empty()) {
+            return "{\"error\":\"missing snapshot name\"}\n";
+        }
+        std::ostringstream out;
+        if (command == "snapshot") {
+            snapshot(from);
+            out << "{\"snapshot\":\"" << jsonEscape(from) << "\",\"time_s\":" << secondsSinceStart(monotonicNanos())
+                << "}\n";
+            return out.str();
+        }
+        
+        std::vector<uint32_t> rowOf;
+        std::vector<uint32_t> rows;
+        std::vector<SiteDelta> deltas;
+        double seconds = 0;
+        if (!diffSnapshots(from, to, rowOf, rows, deltas, seconds)) {
+            return "{\"error\":\"unknown snapshot\"}\n";
+        }
+        out << "{\"from\":\"" << jsonEscape(from) << "\",\"to\":\"" << jsonEscape(to.empty() ? "now" : to)
+            << "\",\"seconds\":" << seconds << ",\"sites\":[";
+        for (size_t i = 0; i < deltas.size() && i < reportRows; i++) {
+            out << (i ? "," : "") << "{\"site\":\"" << jsonEscape(siteName(rows[deltas[i].row]))
+                << "\",\"count_delta\":" << deltas[i].count << ",\"bytes_delta\":" << deltas[i].bytes
+                << ",\"new\":" << (deltas[i].added ? "true" : "false") << "}";
+        }
+        out << "]}\n";
+        return out.str();
+    }
+    
+    // Answers one request: "stats", "sites [N]", "leaks [N]", "all [N]" or
+    // one of the snapshot requests above.
+    // Everything is read from atomic counters; an allocating thread waits
+    // only while its pending site counts are added in.
+    std::string introspectionJsonLocked(const std::string& request) {
+        std::istringstream words(request);
+        std::string command = "all";
+        size_t limit = 10;
+        words >> command;
+        if (command == "snapshot" || command == "diff") {
+            return snapshotJson(command, words);
+        }
+        flushSiteBatches();
+        words >> limit;
+        bool sites = command == "all" || command == "sites";
+        bool leaks = command == "all" || command == "leaks";
+        if (!sites && !leaks && command != "stats") {
+            return "{\"error\":\"unknown request\"}\n";
+        }
+        
+        std::ostringstream out;
+        out << "{\"time_s\":" << secondsSinceStart(monotonicNanos())
+            << ",\"allocations\":" << totalAllocations()
+            << ",\"deallocations\":" << totalDeallocations()
+            << ",\"current_bytes\":" << currentUsage()
+            << ",\"peak_bytes\":" << peakMemoryUsage.load()
+            << ",\"peak_time_s\":" << secondsSinceStart(peakNanos.load())
+            << ",\"sampling_interval\":" << getSamplingInterval()
+            << ",\"profiler_bytes\":" << profilerMemoryUsed()
+            << ",\"dropped_records\":" << droppedRecords.load();
+        
+        std::vector<uint32_t> rowOf;
+        std::vector<uint32_t> rows;
+        if (sites || leaks) {
+            groupSites(rowOf, rows);
+        }
+        if (sites) {
+            std::vector<size_t> liveBytes(rows.size());
+            std::vector<size_t> liveCount(rows.size());
+            std::vector<size_t> allocations(rows.size());
+            for (uint32_t id = 0; id < rowOf.size(); id++) {
+                const CallSite& site = callSites.get(id);
+                liveBytes[rowOf[id]] += site.liveBytes.load(std::memory_order_relaxed);
+                liveCount[rowOf[id]] += site.liveCount.load(std::memory_order_relaxed);
+                allocations[rowOf[id]] += site.allocations.load(std::memory_order_relaxed);
+            }
+            std::vector<uint32_t> order(rows.size());
+            for (uint32_t r = 0; r < rows.size(); r++) {
+                order[r] = r;
+            }
+            size_t shown = selectTop(order, liveBytes, limit);
+            out << ",\"sites\":[";
+            for (size_t i = 0; i < shown; i++) {
+                uint32_t r = order[i];
+                out << (i ? "," : "") << "{\"site\":\"" << jsonEscape(siteName(rows[r]))
+                    << "\",\"allocations\":" << allocations[r] << ",\"live_count\":" << liveCount[r]
+                    << ",\"live_bytes\":" << liveBytes[r] << "}";
+            }
+            out << "]";
+        }
+        if (leaks) {
+            std::vector<size_t> growth(rows.size());
+            std::vector<uint32_t> streak(rows.size());
+            for (uint32_t id = 0; id < rowOf.size() && id < growthStreak.size(); id++) {
+                if (growthStreak[id] >= LEAK_GROWTH_SCANS) {
+                    growth[rowOf[id]] += lastLiveBytes[id] - growthStart[id];
+                    streak[rowOf[id]] = std::max(streak[rowOf[id]], growthStreak[id]);
+                }
+            }
+            std::vector<uint32_t> order;
+            for (uint32_t r = 0; r < rows.size(); r++) {
+                if (growth[r] > 0) {
+                    order.push_back(r);
+                }
+            }
+            size_t shown = selectTop(order, growth, limit);
+            out << ",\"leak_candidates\":[";
+            for (size_t i = 0; i < shown; i++) {
+                uint32_t r = order[i];
+                out << (i ? "," : "") << "{\"site\":\"" << jsonEscape(siteName(rows[r]))
+                    << "\",\"growth_bytes\":" << growth[r] << ",\"growing_for_s\":" << streak[r] << "}";
+            }
+            out << "]";
+        }
+        out << "}\n";
+        return out.str();
+    }
+    
+    // Seconds of uninterrupted growth before a site is reported as a leak
+    // candidate.
+    static const uint32_t LEAK_GROWTH_SCANS = 3;
+    
+#ifndef _WIN32
+    void serveClient(int client) {
+        struct timeval timeout = {1, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        std::string request;
+        char buffer[256];
+        ssize_t received;
+        while (request.size() < 1024 && request.find('\n') == std::string::npos &&
+               (received = recv(client, buffer, sizeof(buffer), 0)) > 0) {
+            request.append(buffer, static_cast<size_t>(received));
+        }
+        request = request.substr(0, request.find('\n'));
+        
+        std::string response;
+        {
+            std::lock_guard<std::mutex> guard(introspectionMutex);
+            response = introspectionJsonLocked(request);
+        }
+        size_t sent = 0;
+        while (sent < response.size()) {
+            ssize_t written = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (written <= 0) {
+                break;
+            }
+            sent += static_cast<size_t>(written);
+        }
+    }
+    
+    void introspectionLoop(int listener) {
+        enterProfilerThread();
+        uint64_t lastScan = 0;
+        while (introspecting.load()) {
+            pollfd ready = {listener, POLLIN, 0};
+            int events = poll(&ready, 1, 200);
+            uint64_t now = monotonicNanos();
+            if (now - lastScan >= 1000000000ULL) {
+                std::lock_guard<std::mutex> guard(introspectionMutex);
+                trackGrowthLocked();
+                lastScan = now;
+            }
+            if (events > 0) {
+                int client = accept(listener, NULL, NULL);
+                if (client >= 0) {
+                    serveClient(client);
+                    close(client);
+                }
+            }
+        }
+        close(listener);
+        unlink(socketPath.c_str());
+    }
+#endif
+    
+    TraceRing* newRing(size_t capacity) {
+        void* memory = metaArena.allocate(sizeof(TraceRing) + capacity * sizeof(TraceEvent));
+        if (!memory) {
+            return NULL;
+        }
+        TraceRing* ring = ::new (memory) TraceRing();
+        ring->capacity = capacity;
+        ring->events = reinterpret_cast<TraceEvent*>(ring + 1);
+        return ring;
+    }
+    
+    // The calling thread's ring, claimed on first use. Returns NULL once the
+    // thread's thread_locals have been destroyed.
+    TraceRing* threadRing() {
+        struct Owner {
+            TraceRing* ring;
+            bool exited;
+            ~Owner() {
+                if (ring) {
+                    ring->owned.store(false, std::memory_order_release);
+                }
+                ring = NULL;
+                exited = true;
+            }
+        };
+        static thread_local Owner owner = {NULL, false};
+        
+        if (!owner.ring && !owner.exited) {
+            for (TraceRing* r = ringList.load(std::memory_order_acquire); r; r = r->next) {
+                bool expected = false;
+                if (!r->owned.load(std::memory_order_relaxed) &&
+                    r->owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                    owner.ring = r;
+                    return r;
+                }
+            }
+            TraceRing* ring = newRing(ringCapacity);
+            if (!ring) {
+                return NULL;
+            }
+            ring->owned.store(true, std::memory_order_relaxed);
+            TraceRing* head = ringList.load(std::memory_order_relaxed);
+            do {
+                ring->next = head;
+            } while (!ringList.compare_exchange_weak(head, ring, std::memory_order_release,
+                                                     std::memory_order_relaxed));
+            owner.ring = ring;
+        }
+        return owner.ring;
+    }
+    
+    // A full ring waits for the flusher instead of dropping the event, since
+    // a lost free would later read as a leak.
+    bool pushEvent(TraceRing& ring, const TraceEvent& event) {
+        uint64_t head = ring.head.load(std::memory_order_relaxed);
+        uint64_t pending = head - ring.tail.load(std::memory_order_acquire);
+        while (pending >= ring.capacity) {
+            if (!flusherRunning.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            flushWake.notify_one();
+            std::this_thread::yield();
+            pending = head - ring.tail.load(std::memory_order_acquire);
+        }
+        ring.events[head & (ring.capacity - 1)] = event;
+        ring.head.store(head + 1, std::memory_order_release);
+        if (pending == ring.capacity / 2) {
+            flushWake.notify_one();
+        }
+        return true;
+    }
+    
+    bool streamEvent(TraceEventType type, const AllocationInfo& info) {
+        TraceEvent event = {info.timestamp, reinterpret_cast<uintptr_t>(info.address), info.size, info.siteId,
+                            TraceEvent::pack(type, info.threadId)};
+        TraceRing* ring = threadRing();
+        if (ring) {
+            return pushEvent(*ring, event);
+        }
+        sharedRingLock.lock();
+        bool pushed = sharedRing && pushEvent(*sharedRing, event);
+        sharedRingLock.unlock();
+        return pushed;
+    }
+    
+    // Defines every call site interned since the last call. A SITE event
+    // carries the name's length and is followed by the name, padded to
+    // whole events.
+    void writeNewSites() {
+        uint32_t count = static_cast<uint32_t>(callSites.size());
+        for (; sitesWritten < count; sitesWritten++) {
+            std::string name = siteName(sitesWritten) + "\n" + siteStack(sitesWritten);
+            TraceEvent event = {0, 0, name.size(), sitesWritten, TraceEvent::pack(TRACE_SITE, 0)};
+            traceFile.append(&event, sizeof(event));
+            name.resize((name.size() + sizeof(TraceEvent) - 1) / sizeof(TraceEvent) * sizeof(TraceEvent), '\0');
+            traceFile.append(name.data(), name.size());
+        }
+    }
+    
+    void drainRing(TraceRing& ring) {
+        uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+        while (tail != ring.flushTo) {
+            size_t index = static_cast<size_t>(tail & (ring.capacity - 1));
+            size_t count = ring.flushTo - tail < ring.capacity - index ? static_cast<size_t>(ring.flushTo - tail)
+                                                                       : ring.capacity - index;
+            if (!traceFile.append(ring.events + index, count * sizeof(TraceEvent))) {
+                droppedRecords.fetch_add(count, std::memory_order_relaxed);
+            }
+            tail += count;
+        }
+        ring.tail.store(tail, std::memory_order_release);
+    }
+    
+    // Writes everything pushed so far. Ring heads are read before the call
+    // site table, so a site is always defined ahead of its first event.
+    void drainRings() {
+        std::lock_guard<std::mutex> guard(drainMutex);
+        TraceRing* rings = ringList.load(std::memory_order_acquire);
+        for (TraceRing* r = rings; r; r = r->next) {
+            r->flushTo = r->head.load(std::memory_order_acquire);
+        }
+        sharedRing->flushTo = sharedRing->head.load(std::memory_order_acquire);
+        writeNewSites();
+        for (TraceRing* r = rings; r; r = r->next) {
+            drainRing(*r);
+        }
+        drainRing(*sharedRing);
+    }
+    
+    void flushLoop() {
+        enterProfilerThread();
+        std::unique_lock<std::mutex> lock(flushMutex);
+        while (!stopFlush) {
+            flushWake.wait_for(lock, std::chrono::milliseconds(10));
+            lock.unlock();
+            drainRings();
+            lock.lock();
+        }
+    }
+    
+    BasicMemoryProfiler() : threadList(&sharedCounters), threadDirectory(metaArena), retiredThreads(0), callSites(arena),
+                       stacks(arena), stackDepth(0),
+                       stackUnwinder(UNWIND_FRAME_POINTER), startWallClock(time(0)), startNanos(monotonicNanos()),
+                       currentMemoryUsage(0), peakMemoryUsage(0), peakNanos(0),
+                       peakSites(ArenaAllocator<LeakTotals>(&metaArena)), peakSnapshotBytes(0), peakSnapshotNanos(0),
+                       nextPeakSnapshot(0), timelineSize(0), timelineStride(1), timelineSkip(0), timelineInterval(0),
+                       stopTimeline(false), droppedRecords(0),
+                       samplingInterval(0), sampledFilter(NULL), spareFilter(NULL),
+                       filterBitsSet(0), filterRebuildAt(FILTER_WORDS * 64 / 4),
+                       leakSites(ArenaAllocator<LeakTotals>(&metaArena)),
+                       leakList(ArenaAllocator<AllocationInfo>(&metaArena)), leakRecords(0), leakCount(0),
+                       leakedBytes(0), reportRows(100),
+                       logStream(&std::cout), streaming(false), flusherRunning(false), ringList(NULL),
+                       sharedRing(NULL), ringCapacity(0), stopFlush(false), sitesWritten(0),
+                       quarantineBudget(0), quarantineLimit(0), releaseBlock(NULL), quarantine(NULL),
+                       quarantineCapacity(0), quarantineHead(0), quarantineCount(0), quarantineBytes(0),
+                       quarantined(&metaArena), tableForgotten(false), heapErrorLog(NULL), heapErrorsLogged(0),
+                       survivorSnapshots(2), introspecting(false) {
+        for (size_t t = 0; t < HEAP_ERROR_TYPES; t++) {
+            heapErrorCounts[t].store(0, std::memory_order_relaxed);
+        }
+        for (size_t s = 0; s < SHARD_COUNT; s++) {
+            shards[s].table.setArena(&arena);
+        }
+        sharedCounters.shared = true;
+    }
+    
+public:
+    static BasicMemoryProfiler& getInstance() {
+        // Constructed in static storage and never destroyed, so frees issued
+        // by other static destructors at exit still find a live profiler.
+        alignas(BasicMemoryProfiler) static char storage[sizeof(BasicMemoryProfiler)];
+        static BasicMemoryProfiler* instance = ::new (storage) BasicMemoryProfiler();
+        return *instance;
+    }
+    
+    // file/line come from the `new` macro; caller is the return address of
+    // the allocation hook and identifies the site when no file is known.
+    void recordAllocation(void* ptr, size_t size, const char* file, int line, const void* caller = NULL,
+                          AllocationKind kind = ALLOC_PLAIN) {
+        if (!Policy::enabled || inProfiler()) {
+            return;
+        }
+        
+        size_t interval = samplingInterval.load(std::memory_order_relaxed);
+        if (interval != 0) {
+            SamplerState& sampler = threadSampler();
+            if (sampler.interval != interval) {
+                // First use on this thread, or the interval changed: start
+                // a fresh countdown rather than sampling this allocation.
+                sampler.interval = interval;
+                sampler.bytesUntilSample = sampler.nextInterval(interval);
+            }
+            sampler.bytesUntilSample -= static_cast<int64_t>(size);
+            if (sampler.bytesUntilSample > 0) {
+                return;
+            }
+            sampler.bytesUntilSample = sampler.nextInterval(interval);
+        }
+        ProfilerScope scope;
+        
+        AllocationInfo info;
+        info.address = ptr;
+        info.size = size;
+        info.timestamp = Policy::timestamps ? monotonicNanos() : 0;
+        info.siteId = CallSiteTable::NO_ID;
+        if constexpr (Policy::siteAggregation) {
+            uint32_t stackId = StackTable::NO_ID;
+            uint32_t depth = Policy::stackCapture ? stackDepth.load(std::memory_order_relaxed) : 0;
+            if (depth != 0) {
+                stackId = captureStackId(caller, depth);
+            }
+            CallSiteKey key = {file, line, caller, stackId};
+            info.siteId = siteIdFor(key);
+        }
+        info.threadId = Policy::threadIds ? currentThreadId() : 0;
+        info.kind = kind;
+        
+        uint64_t hash = hashPointer(ptr);
+        bool streamed = streaming.load(std::memory_order_acquire);
+        if (streamed) {
+            if (!streamEvent(TRACE_ALLOC, info)) {
+                droppedRecords.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        } else if (Policy::leakTracking) {
+            AllocationShard& shard = shardFor(hash);
+            AllocationInfo previous;
+            shard.lock.lock();
+            bool inserted = shard.table.insert(info, hash, &previous);
+            shard.lock.unlock();
+            
+            if (!inserted) {
+                droppedRecords.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            if (previous.address != NULL) {
+                // Same address recorded twice without a free in between.
+                releaseLive(previous, 0);
+            }
+        }
+        std::atomic<uint64_t>* filter = sampledFilter.load(std::memory_order_acquire);
+        if (interval != 0 && filter) {
+            size_t bit = filterBit(hash);
+            uint64_t mask = uint64_t(1) << (bit % 64);
+            if ((filter[bit / 64].fetch_or(mask, std::memory_order_relaxed) & mask) == 0 &&
+                filterBitsSet.fetch_add(1, std::memory_order_relaxed) + 1 >= filterRebuildAt.load(std::memory_order_relaxed) &&
+                !streamed) {
+                rebuildFilter();
+            }
+        }
+        
+        // With sampling on, every counter below holds an unbiased estimate:
+        // each sample stands for 1/p allocations of its size.
+        size_t count = estimatedCount(size);
+        size_t bytes = estimatedBytes(size);
+        ThreadCounters& counters = threadCounters();
+        bump(counters.allocations, count, counters.shared);
+        // A streamed free carries no size, so usage is left to the analyzer.
+        bool live = !streamed && Policy::leakTracking;
+        if (info.siteId != CallSiteTable::NO_ID) {
+            CallSite& site = callSites.get(info.siteId);
+            raiseTo(site.largest, size);
+            raiseTo(site.smallestInverse, ~size);
+            if (counters.sites) {
+                counters.sites->lock.lock();
+                PendingSite& entry = pendingSite(*counters.sites, info.siteId);
+                entry.allocations += count;
+                entry.allocatedBytes += bytes;
+                entry.sizeClasses[sizeClassOf(size)] += count;
+                if (live) {
+                    entry.liveCount += static_cast<int64_t>(count);
+                    entry.liveBytes += static_cast<int64_t>(bytes);
+                    entry.liveHigh = std::max(entry.liveHigh, entry.liveCount);
+                }
+                counters.sites->lock.unlock();
+            } else {
+                site.allocations.fetch_add(count, std::memory_order_relaxed);
+                site.allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+                site.sizeClasses[sizeClassOf(size)].fetch_add(count, std::memory_order_relaxed);
+                if (live) {
+                    raiseTo(site.peakLive, site.liveCount.fetch_add(count, std::memory_order_relaxed) + count);
+                    site.liveBytes.fetch_add(bytes, std::memory_order_relaxed);
+                }
+            }
+        }
+        if (!live) {
+            return;
+        }
+        
+        bump(counters.allocatedBytes, bytes, counters.shared);
+        raiseThreadPeak(counters, info.timestamp);
+        checkPeak(currentMemoryUsage.fetch_add(bytes, std::memory_order_relaxed) + bytes, info.timestamp);
+    }
+    
+    // kind is the form of the free and caller the code that made it, both
+    // used only by the quarantine. Returns false when the block must not be
+    // released: it is held in the quarantine, or the free was reported as a
+    // heap error.
+    bool recordDeallocation(void* ptr, AllocationKind kind = ALLOC_PLAIN, const void* caller = NULL) {
+        if (!Policy::enabled || inProfiler()) {
+            return true;
+        }
+        
+        uint64_t hash = hashPointer(ptr);
+        std::atomic<uint64_t>* filter = sampledFilter.load(std::memory_order_acquire);
+        if (filter && samplingInterval.load(std::memory_order_relaxed) != 0) {
+            size_t bit = filterBit(hash);
+            if ((filter[bit / 64].load(std::memory_order_relaxed) & (uint64_t(1) << (bit % 64))) == 0) {
+                return true;
+            }
+        }
+        ProfilerScope scope;
+        
+        if (streaming.load(std::memory_order_acquire)) {
+            AllocationInfo info = {ptr, 0, Policy::timestamps ? monotonicNanos() : 0, CallSiteTable::NO_ID,
+                                   Policy::threadIds ? currentThreadId() : 0, ALLOC_PLAIN};
+            if (streamEvent(TRACE_FREE, info)) {
+                countFrees(1);
+            } else {
+                droppedRecords.fetch_add(1, std::memory_order_relaxed);
+            }
+            return true;
+        }
+        if (!Policy::leakTracking) {
+            countFrees(1);
+            return true;
+        }
+        
+        AllocationShard& shard = shardFor(hash);
+        AllocationInfo removed;
+        shard.lock.lock();
+        bool found = shard.table.erase(ptr, hash, &removed);
+        shard.lock.unlock();
+        
+        bool checking = quarantineBudget.load(std::memory_order_relaxed) != 0;
+        if (found) {
+            releaseLive(removed, Policy::timestamps ? monotonicNanos() : 0);
+            countFrees(estimatedCount(removed.size));
+            if (!checking) {
+                return true;
+            }
+            if (removed.kind != ALLOC_PLAIN && kind != ALLOC_PLAIN && removed.kind != static_cast<unsigned>(kind)) {
+                addHeapError(MISMATCHED_FREE, removed, kind, caller, 0);
+            }
+            return !enterQuarantine(removed);
+        }
+        return !checking || !reportUnknownFree(ptr, hash, kind, caller);
+    }
+    
+    size_t totalAllocations() const {
+        size_t total = 0;
+        for (ThreadCounters* t = threadList.load(std::memory_order_acquire); t; t = t->next) {
+            total += t->allocations.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+    
+    size_t totalDeallocations() const {
+        size_t total = 0;
+        for (ThreadCounters* t = threadList.load(std::memory_order_acquire); t; t = t->next) {
+            total += t->deallocations.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+    
+    // Debug mode for heap misuse. Freed blocks are filled with a poison
+    // pattern and held back from the allocator, oldest released first, so
+    // that at most `bytes` wait at any time; blocks larger than that are
+    // released at once. Double frees, frees of pointers that were never
+    // allocated and delete/delete[] mismatches are recorded with the site
+    // that allocated the block, and bad pointers never reach the allocator.
+    // A held block whose poison has changed is reported as written after
+    // free. Blocks are released through `release`. 0 turns it off and
+    // releases every held block. Needs leak tracking; returns false if the
+    // quarantine cannot be set up.
+    bool setQuarantine(size_t bytes, void (*release)(void*) = free) {
+#ifdef _WIN32
+        // Over-aligned blocks there need _aligned_free, which the ring does
+        // not record.
+        if (bytes != 0) {
+            return false;
+        }
+#endif
+        if (!Policy::leakTracking && bytes != 0) {
+            return false;
+        }
+        ProfilerScope scope;
+        quarantineLock.lock();
+        quarantineBudget.store(0, std::memory_order_relaxed);
+        while (quarantineCount > 0) {
+            evictOldestLocked();
+        }
+        if (quarantine) {
+            metaArena.deallocate(quarantine, quarantineCapacity * sizeof(AllocationInfo));
+            quarantine = NULL;
+        }
+        quarantined.release();
+        quarantineLimit = bytes;
+        bool ready = true;
+        if (bytes != 0) {
+            if (!heapErrorLog) {
+                heapErrorLog = static_cast<HeapError*>(metaArena.allocate(MAX_HEAP_ERRORS * sizeof(HeapError)));
+            }
+            // One slot per 512 bytes of budget keeps the ring and its index
+            // small next to the blocks they hold.
+            quarantineCapacity = std::min(std::max(bytes / 512, size_t(1024)), size_t(1) << 20);
+            quarantine = static_cast<AllocationInfo*>(metaArena.allocate(quarantineCapacity * sizeof(AllocationInfo)));
+            ready = quarantine && heapErrorLog;
+            if (ready) {
+                quarantineHead = 0;
+                releaseBlock = release;
+                quarantineBudget.store(bytes, std::memory_order_relaxed);
+            }
+        }
+        quarantineLock.unlock();
+        return ready;
+    }
+    
+    size_t getQuarantineBudget() const { return quarantineBudget.load(std::memory_order_relaxed); }
+    
+    // Recorded size of a live block, 0 if the block is not tracked.
+    size_t trackedSize(const void* ptr) {
+        uint64_t hash = hashPointer(ptr);
+        AllocationShard& shard = shardFor(hash);
+        shard.lock.lock();
+        const AllocationInfo* info = shard.table.find(ptr, hash);
+        size_t size = info ? info->size : 0;
+        shard.lock.unlock();
+        return size;
+    }
+    
+    // For a resize that may fail: takes a live block's record out of the
+    // table without counting a free, so the address cannot be recorded for
+    // another block meanwhile. False if the block is not tracked. The record
+    // then goes either back with reattachAllocation or to releaseDetached.
+    bool detachAllocation(void* ptr, AllocationInfo& record) {
+        if (!Policy::enabled || !Policy::leakTracking || inProfiler() || streaming.load(std::memory_order_acquire)) {
+            return false;
+        }
+        ProfilerScope scope;
+        uint64_t hash = hashPointer(ptr);
+        AllocationShard& shard = shardFor(hash);
+        shard.lock.lock();
+        bool found = shard.table.erase(ptr, hash, &record);
+        shard.lock.unlock();
+        return found;
+    }
+    
+    // Puts a detached record back as it was, site and timestamp included.
+    void reattachAllocation(const AllocationInfo& record) {
+        if (streaming.load(std::memory_order_acquire)) {
+            // Forgotten along with the rest of the table.
+            return;
+        }
+        ProfilerScope scope;
+        uint64_t hash = hashPointer(record.address);
+        AllocationShard& shard = shardFor(hash);
+        AllocationInfo previous;
+        shard.lock.lock();
+        bool inserted = shard.table.insert(record, hash, &previous);
+        shard.lock.unlock();
+        if (!inserted) {
+            droppedRecords.fetch_add(1, std::memory_order_relaxed);
+            releaseLive(record, 0);
+        } else if (previous.address != NULL) {
+            releaseLive(previous, 0);
+        }
+    }
+    
+    // Counts the free of a detached record whose block is gone.
+    void releaseDetached(const AllocationInfo& record) {
+        if (streaming.load(std::memory_order_acquire)) {
+            return;
+        }
+        ProfilerScope scope;
+        releaseLive(record, Policy::timestamps ? monotonicNanos() : 0);
+        countFrees(estimatedCount(record.size));
+    }
+    
+    size_t heapErrorCount(HeapErrorType type) const { return heapErrorCounts[type].load(std::memory_order_relaxed); }
+    
+    // Records on average one allocation per `bytes` allocated bytes, with
+    // counts and sizes in reports scaled back up to estimates. 0 records
+    // every allocation. Set it before the allocations of interest: records
+    // are re-weighted with the current interval when they are freed.
+    void setSamplingInterval(size_t bytes) {
+        if (bytes != 0 && !sampledFilter.load(std::memory_order_acquire)) {
+            ProfilerScope scope;
+            void* words = arena.allocate(FILTER_WORDS * sizeof(uint64_t));
+            if (!words) {
+                return;
+            }
+            sampledFilter.store(static_cast<std::atomic<uint64_t>*>(words), std::memory_order_release);
+        }
+        samplingInterval.store(bytes, std::memory_order_relaxed);
+    }
+    
+    size_t getSamplingInterval() const { return samplingInterval.load(std::memory_order_relaxed); }
+    
+    // Captures up to `depth` frames of every recorded allocation's stack and
+    // groups sites by full stack; 0 turns capture off. Frame pointer walking
+    // needs the profiled code built with -fno-omit-frame-pointer.
+    void setStackDepth(uint32_t depth, StackUnwinder unwinder = UNWIND_FRAME_POINTER) {
+        stackUnwinder.store(unwinder, std::memory_order_relaxed);
+        stackDepth.store(depth < MAX_STACK_DEPTH ? depth : MAX_STACK_DEPTH, std::memory_order_relaxed);
+    }
+    
+    uint32_t getStackDepth() const { return stackDepth.load(std::memory_order_relaxed); }
+    
+    // Streams every recorded allocation and free to a binary trace file
+    // instead of tracking it in memory, so profiler memory stays bounded
+    // however long the process runs; memprof_analyze rebuilds leaks, peaks
+    // and site statistics from the file. Allocations tracked so far are
+    // written first. Each thread buffers up to ringEvents events between
+    // flushes. Returns false if the trace file cannot be created.
+    bool startStreaming(const std::string& path, size_t ringEvents = 8192) {
+        ProfilerScope scope;
+        if (streaming.load() || !traceFile.open(path.c_str())) {
+            return false;
+        }
+        ringCapacity = 64;
+        while (ringCapacity < ringEvents) {
+            ringCapacity *= 2;
+        }
+        if (!sharedRing) {
+            sharedRing = newRing(ringCapacity);
+            if (!sharedRing) {
+                traceFile.close();
+                return false;
+            }
+            sharedRing->owned.store(true, std::memory_order_relaxed);
+        }
+        
+        TraceHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+        header.version = TRACE_VERSION;
+        header.eventSize = sizeof(TraceEvent);
+        header.startNanos = startNanos;
+        header.startWallClock = static_cast<int64_t>(startWallClock);
+        header.samplingInterval = getSamplingInterval();
+        traceFile.append(&header, sizeof(header));
+        
+        for (size_t s = 0; s < SHARD_COUNT; s++) {
+            shards[s].lock.lock();
+        }
+        {
+            std::lock_guard<std::mutex> guard(drainMutex);
+            sitesWritten = 0;
+            writeNewSites();
+            for (size_t s = 0; s < SHARD_COUNT; s++) {
+                shards[s].table.forEach([this](const AllocationInfo& info) {
+                    TraceEvent event = {info.timestamp, reinterpret_cast<uintptr_t>(info.address), info.size,
+                                        info.siteId, TraceEvent::pack(TRACE_ALLOC, info.threadId)};
+                    traceFile.append(&event, sizeof(event));
+                });
+                shards[s].table.forget();
+            }
+        }
+        currentMemoryUsage.store(0, std::memory_order_relaxed);
+        tracePath = path;
+        stopFlush = false;
+        flusherRunning.store(true);
+        streaming.store(true, std::memory_order_release);
+        for (size_t s = 0; s < SHARD_COUNT; s++) {
+            shards[s].lock.unlock();
+        }
+        flusher = std::thread(&BasicMemoryProfiler::flushLoop, this);
+        return true;
+    }
+    
+    // Writes out the buffered events and closes the trace. Allocations made
+    // from here on are tracked in memory again.
+    void stopStreaming() {
+        ProfilerScope scope;
+        if (!streaming.exchange(false)) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> guard(flushMutex);
+            stopFlush = true;
+        }
+        flushWake.notify_one();
+        flusher.join();
+        flusherRunning.store(false);
+        drainRings();
+        traceFile.close();
+    }
+    
+    bool isStreaming() const { return streaming.load(std::memory_order_relaxed); }
+    
+    // Records a named marker of the heap's state: the current time, which
+    // splits live allocations into older and newer by their timestamps, and
+    // every site's live totals. The cost grows with the number of call
+    // sites, not allocations, so one can be taken every minute under load.
+    // The oldest snapshot is dropped once there are MAX_SNAPSHOTS.
+    void snapshot(const std::string& name) {
+        ProfilerScope scope;
+        HeapSnapshot marker;
+        marker.name = name;
+        marker.nanos = monotonicNanos();
+        currentSiteTotals(marker.sites);
+        std::lock_guard<std::mutex> guard(snapshotMutex);
+        if (snapshots.size() == MAX_SNAPSHOTS) {
+            snapshots.erase(snapshots.begin());
+        }
+        snapshots.push_back(std::move(marker));
+    }
+    
+    // Prints how each site's live allocations changed between two snapshots,
+    // largest growth first; an empty `to` compares against the heap now.
+    bool printSnapshotDiff(const std::string& from, const std::string& to = "") {
+        ProfilerScope scope;
+        std::vector<uint32_t> rowOf;
+        std::vector<uint32_t> rows;
+        std::vector<SiteDelta> deltas;
+        double seconds = 0;
+        if (!diffSnapshots(from, to, rowOf, rows, deltas, seconds)) {
+            return false;
+        }
+        (*logStream) << "\n========================================\n";
+        (*logStream) << "    HEAP DIFF: " << from << " -> " << (to.empty() ? "now" : to) << " (" << seconds << " s)\n";
+        (*logStream) << "========================================\n\n";
+        size_t shown = std::min(deltas.size(), reportRows);
+        for (size_t i = 0; i < shown; i++) {
+            char line[64];
+            snprintf(line, sizeof(line), "%+12.1f KB %+10lld  ", deltas[i].bytes / 1024.0, deltas[i].count);
+            (*logStream) << line << siteName(rows[deltas[i].row]) << (deltas[i].added ? "  [new]" : "") << "\n";
+        }
+        if (shown < deltas.size()) {
+            (*logStream) << "  ... " << (deltas.size() - shown) << " more sites\n";
+        }
+        (*logStream) << "\n";
+        return true;
+    }
+    
+    // Number of snapshots an allocation must have outlived to appear in the
+    // report's survivor table; 2 by default, 0 leaves the table out.
+    void setSurvivorSnapshots(size_t count) { survivorSnapshots = count; }
+    
+    // Prints, by site, the live allocations that were made before the
+    // snapshot taken `count` snapshots ago and so have outlived `count`
+    // snapshots. Returns false if fewer snapshots were taken.
+    bool printSurvivors(size_t count) {
+        ProfilerScope scope;
+        uint64_t cutoff = snapshotCutoff(count);
+        if (cutoff == 0) {
+            return false;
+        }
+        std::vector<uint32_t> rowOf;
+        std::vector<uint32_t> rows;
+        groupSites(rowOf, rows);
+        std::vector<LeakTotals> survivors;
+        totalsMadeBefore(cutoff, rowOf, rows.size(), survivors);
+        std::vector<size_t> bytes(survivors.size());
+        std::vector<uint32_t> order;
+        for (uint32_t r = 0; r < survivors.size(); r++) {
+            bytes[r] = survivors[r].bytes;
+            if (survivors[r].count > 0) {
+                order.push_back(r);
+            }
+        }
+        size_t shown = selectTop(order, bytes, reportRows);
+        
+        (*logStream) << "\n========================================\n";
+        (*logStream) << "    OUTLIVED " << count << " SNAPSHOTS\n";
+        (*logStream) << "========================================\n\n";
+        for (size_t i = 0; i < shown; i++) {
+            char line[64];
+            snprintf(line, sizeof(line), "%12.1f KB %10zu  ", survivors[order[i]].bytes / 1024.0, survivors[order[i]].count);
+            (*logStream) << line << siteName(order[i] < rows.size() ? rows[order[i]] : CallSiteTable::NO_ID) << "\n";
+        }
+        (*logStream) << "\n";
+        return true;
+    }
+    
+    // Serves counters, the top sites by live bytes and leak candidates as
+    // JSON on a Unix domain socket, one request line per connection; see
+    // memprof_client. Returns false if the socket cannot be created.
+    bool startIntrospection(const std::string& path) {
+#ifdef _WIN32
+        (void)path;
+        return false;
+#else
+        ProfilerScope scope;
+        sockaddr_un address;
+        if (introspecting.load() || path.size() >= sizeof(address.sun_path)) {
+            return false;
+        }
+        int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listener < 0) {
+            return false;
+        }
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, path.c_str(), path.size());
+        unlink(path.c_str());
+        if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 8) != 0) {
+            close(listener);
+            return false;
+        }
+        socketPath = path;
+        introspecting.store(true);
+        introspectionThread = std::thread(&BasicMemoryProfiler::introspectionLoop, this, listener);
+        return true;
+#endif
+    }
+    
+    void stopIntrospection() {
+        ProfilerScope scope;
+        if (introspecting.exchange(false)) {
+            introspectionThread.join();
+        }
+    }
+    
+    // Samples current usage every `milliseconds` on a background thread for
+    // the report's usage-over-time chart; 0 stops sampling. Sampling only
+    // reads the live byte counter, so it adds nothing to the allocation
+    // path.
+    void setTimelineInterval(size_t milliseconds) {
+        ProfilerScope scope;
+        size_t previous = timelineInterval.exchange(milliseconds);
+        if (previous == 0 && milliseconds != 0) {
+            stopTimeline = false;
+            timelineThread = std::thread(&BasicMemoryProfiler::timelineLoop, this);
+        } else if (previous != 0 && milliseconds == 0) {
+            {
+                std::lock_guard<std::mutex> guard(timelineMutex);
+                stopTimeline = true;
+            }
+            timelineWake.notify_one();
+            timelineThread.join();
+        }
+    }
+    
+    size_t getTimelineInterval() const { return timelineInterval.load(); }
+    
+    // Rows shown per report table; the rest are collapsed into one line.
+    void setReportRowLimit(size_t rows) { reportRows = rows; }
+    
+    // Stream for the summary and report notices; stdout by default.
+    void setLogStream(std::ostream& out) { logStream = &out; }
+    
+    // Caps the memory mapped for the allocation and call site tables; 0
+    // means unlimited. Allocations that do not fit are counted as dropped.
+    void setMemoryLimit(size_t bytes) {
+        arena.setByteLimit(bytes);
+    }
+    
+    size_t profilerMemoryUsed() const { return arena.used() + metaArena.used(); }
+    size_t profilerMemoryMapped() const { return arena.mapped() + metaArena.mapped(); }
+    
+    // Forgets every tracked allocation and call site and returns the table
+    // memory to the OS. Only call this while no other thread allocates.
+    void reset() {
+        ProfilerScope scope;
+        for (size_t s = 0; s < SHARD_COUNT; s++) {
+            shards[s].lock.lock();
+        }
+        std::lock_guard<std::mutex> guard(drainMutex);
+        // The timeline and introspection threads read the call site table,
+        // so they are held off until it is rebuilt.
+        std::lock_guard<std::mutex> timelineGuard(timelineMutex);
+        std::lock_guard<std::mutex> introspectionGuard(introspectionMutex);
+        peakLock.lock();
+        
+        leakSites.clear();
+        leakList.clear();
+        leakRecords = 0;
+        leakCount = 0;
+        leakedBytes = 0;
+        for (size_t s = 0; s < SHARD_COUNT; s++) {
+            shards[s].table.forget();
+        }
+        flushSiteBatches(true);
+        callSites.reset();
+        stacks.reset();
+        sitesWritten = 0;
+        symbolCache.clear();
+        size_t interval = samplingInterval.exchange(0);
+        sampledFilter.store(NULL, std::memory_order_release);
+        spareFilter = NULL;
+        filterBitsSet.store(0, std::memory_order_relaxed);
+        filterRebuildAt.store(FILTER_WORDS * 64 / 4, std::memory_order_relaxed);
+        arena.reset();
+        setSamplingInterval(interval);
+        
+        for (ThreadCounters* t = threadList.load(std::memory_order_acquire); t; t = t->next) {
+            t->allocations.store(0, std::memory_order_relaxed);
+            t->deallocations.store(0, std::memory_order_relaxed);
+            t->allocatedBytes.store(0, std::memory_order_relaxed);
+            t->freedBytes.store(0, std::memory_order_relaxed);
+            t->peakBytes.store(0, std::memory_order_relaxed);
+            t->peakNanos.store(0, std::memory_order_relaxed);
+            t->remoteFreedBytes.store(0, std::memory_order_relaxed);
+            t->remoteBase.store(0, std::memory_order_relaxed);
+            for (RemoteFrees* cell = t->outgoing.load(std::memory_order_acquire); cell; cell = cell->nextOutgoing) {
+                cell->count.store(0, std::memory_order_relaxed);
+                cell->bytes.store(0, std::memory_order_relaxed);
+            }
+        }
+        peakMemoryUsage.store(0, std::memory_order_relaxed);
+        peakNanos.store(0, std::memory_order_relaxed);
+        currentMemoryUsage.store(0, std::memory_order_relaxed);
+        retiredThreads.store(0, std::memory_order_relaxed);
+        droppedRecords.store(0, std::memory_order_relaxed);
+        peakSites.clear();
+        peakSnapshotBytes = 0;
+        peakSnapshotNanos = 0;
+        nextPeakSnapshot.store(0, std::memory_order_relaxed);
+        timelineSize = 0;
+        timelineStride = 1;
+        timelineSkip = 0;
+        lastLiveBytes.clear();
+        growthStart.clear();
+        growthStreak.clear();
+        {
+            std::lock_guard<std::mutex> snapshotGuard(snapshotMutex);
+            snapshots.clear();
+        }
+        tableForgotten = true;
+        heapErrorLock.lock();
+        heapErrorsLogged = 0;
+        for (size_t t = 0; t < HEAP_ERROR_TYPES; t++) {
+            heapErrorCounts[t].store(0, std::memory_order_relaxed);
+        }
+        heapErrorLock.unlock();
+        
+        peakLock.unlock();
+        for (size_t s = 0; s < SHARD_COUNT; s++) {
+            shards[s].lock.unlock();
+        }
+    }
+    
+    // Totals the live allocations by site in one pass over the table and
+    // keeps only the largest ones, so the cost does not depend on how many
+    // leaks are shown.
+    void detectLeaks() {
+        ProfilerScope scope;
+        checkQuarantine();
+        size_t siteCount = callSites.size();
+        LeakTotals none = {0, 0};
+        leakSites.assign(siteCount + 1, none);
+        leakList.clear();
+        leakRecords = 0;
+        leakCount = 0;
+        leakedBytes = 0;
+        
+        for (size_t s = 0; s < SHARD_COUNT; s++) {
+            AllocationShard& shard = shards[s];
+            shard.lock.lock();
+            shard.table.forEach([this, siteCount](const AllocationInfo& info) {
+                size_t count = estimatedCount(info.size);
+                size_t bytes = estimatedBytes(info.size);
+                LeakTotals& totals = leakSites[info.siteId < siteCount ? info.siteId : siteCount];
+                totals.count += count;
+                totals.bytes += bytes;
+                leakRecords++;
+                leakCount += count;
+                leakedBytes += bytes;
+                
+                if (leakList.size() < reportRows) {
+                    leakList.push_back(info);
+                    std::push_heap(leakList.begin(), leakList.end(), largerAllocation);
+                } else if (reportRows != 0 && info.size > leakList.front().size) {
+                    std::pop_heap(leakList.begin(), leakList.end(), largerAllocation);
+                    leakList.back() = info;
+                    std::push_heap(leakList.begin(), leakList.end(), largerAllocation);
+                }
+            });
+            shard.lock.unlock();
+        }
+    }
+    
+    void generateHTMLReport(const std::string& filename = "memory_report.html") {
+        ProfilerScope scope;
+        flushSiteBatches();
+        detectLeaks();
+        size_t totalAllocs = totalAllocations();
+        size_t totalDeallocs = totalDeallocations();
+        size_t usage = currentUsage();
+        
+        // A large stream buffer turns the many small writes below into a
+        // few big ones. It has to be installed before the file is opened.
+        std::vector<char> buffer(size_t(1) << 20);
+        std::ofstream file;
+        file.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        file.open(filename.c_str());
+        
+        file << "<!DOCTYPE html>\n";
+        file << "<html lang=\"en\">\n";
+        file << "<head>\n";
+        file << "    <meta charset=\"UTF-8\">\n";
+        file << "    <meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">\n";
+        file << "    <title>Memory Profiler Report</title>\n";
+        file << "    <style>\n";
+        file << "        * { margin: 0; padding: 0; box-sizing: border-box; }\n";
+        file << "        body { font-family: 'Segoe UI', Tahoma, Geneva, Verdana, sans-serif;\n";
+        file << "               background: linear-gradient(135deg, #667eea 0%, #764ba2 100%);\n";
+        file << "               padding: 20px; min-height: 100vh; }\n";
+        file << "        .container { max-width: 1400px; margin: 0 auto; }\n";
+        file << "        .header { background: white; padding: 30px; border-radius: 15px;\n";
+        file << "                  box-shadow: 0 10px 30px rgba(0,0,0,0.2); margin-bottom: 20px; text-align: center; }\n";
+        file << "        .header h1 { color: #667eea; font-size: 2.5em; margin-bottom: 10px; }\n";
+        file << "        .header .subtitle { color: #666; font-size: 1.1em; }\n";
+        file << "        .stats-grid { display: grid; grid-template-columns: repeat(auto-fit, minmax(250px, 1fr));\n";
+        file << "                      gap: 20px; margin-bottom: 20px; }\n";
+        file << "        .stat-card { background: white; padding: 25px; border-radius: 15px;\n";
+        file << "                     box-shadow: 0 5px 15px rgba(0,0,0,0.1); transition: transform 0.3s; }\n";
+        file << "        .stat-card:hover { transform: translateY(-5px); box-shadow: 0 10px 25px rgba(0,0,0,0.2); }\n";
+        file << "        .stat-card .icon { font-size: 2em; margin-bottom: 10px; }\n";
+        file << "        .stat-card .label { color: #666; font-size: 0.9em; margin-bottom: 5px; }\n";
+        file << "        .stat-card .value { font-size: 2em; font-weight: bold; color: #333; }\n";
+        file << "        .leak-alert { background: #fff3cd; border-left: 5px solid #ffc107;\n";
+        file << "                      padding: 20px; border-radius: 10px; margin-bottom: 20px; }\n";
+        file << "        .leak-critical { background: #f8d7da; border-left: 5px solid #dc3545; }\n";
+        file << "        .section { background: white; padding: 30px; border-radius: 15px;\n";
+        file << "                   box-shadow: 0 5px 15px rgba(0,0,0,0.1); margin-bottom: 20px; }\n";
+        file << "        .section h2 { color: #667eea; margin-bottom: 20px; padding-bottom: 10px;\n";
+        file << "                      border-bottom: 3px solid #667eea; }\n";
+        file << "        table { width: 100%; border-collapse: collapse; margin-top: 15px; }\n";
+        file << "        th, td { padding: 12px; text-align: left; border-bottom: 1px solid #ddd; }\n";
+        file << "        th { background: #667eea; color: white; font-weight: 600; }\n";
+        file << "        tr:hover { background: #f5f5f5; }\n";
+        file << "        .progress-bar { width: 100%; height: 30px; background: #e0e0e0;\n";
+        file << "                        border-radius: 15px; overflow: hidden; margin: 10px 0; }\n";
+        file << "        .progress-fill { height: 100%; background: linear-gradient(90deg, #667eea, #764ba2);\n";
+        file << "                         display: flex; align-items: center; justify-content: center;\n";
+        file << "                         color: white; font-weight: bold; transition: width 0.3s; }\n";
+        file << "        .badge { display: inline-block; padding: 5px 10px; border-radius: 20px;\n";
+        file << "                 font-size: 0.85em; font-weight: 600; }\n";
+        file << "        .badge-danger { background: #dc3545; color: white; }\n";
+        file << "        .badge-warning { background: #ffc107; color: #333; }\n";
+        file << "        .badge-success { background: #28a745; color: white; }\n";
+        file << "    </style>\n";
+        file << "</head>\n";
+        file << "<body>\n";
+        file << "    <div class=\"container\">\n";
+        file << "        <div class=\"header\">\n";
+        file << "            <h1>🔍 Memory Profiler Report</h1>\n";
+        file << "            <p class=\"subtitle\">Comprehensive Memory Analysis & Leak Detection</p>\n";
+        file << "            <p class=\"subtitle\">Generated: " << getCurrentTimestamp() << "</p>\n";
+        if (getSamplingInterval() != 0) {
+            file << "            <p class=\"subtitle\">Sampled on average once every " << getSamplingInterval()
+                 << " bytes; counts and sizes are estimates</p>\n";
+        }
+        if (isStreaming()) {
+            file << "            <p class=\"subtitle\">Streaming to " << htmlEscape(tracePath)
+                 << "; run memprof_analyze on it for usage and leaks</p>\n";
+        }
+        file << "        </div>\n";
+        
+        // Statistics Cards
+        file << "        <div class=\"stats-grid\">\n";
+        file << "            <div class=\"stat-card\"><div class=\"icon\">📊</div>\n";
+        file << "                <div class=\"label\">Total Allocations</div>\n";
+        file << "                <div class=\"value\">" << totalAllocs << "</div></div>\n";
+        file << "            <div class=\"stat-card\"><div class=\"icon\">✅</div>\n";
+        file << "                <div class=\"label\">Total Deallocations</div>\n";
+        file << "                <div class=\"value\">" << totalDeallocs << "</div></div>\n";
+        file << "            <div class=\"stat-card\"><div class=\"icon\">💾</div>\n";
+        file << "                <div class=\"label\">Current Usage</div>\n";
+        file << "                <div class=\"value\">" << (usage / 1024.0) << " KB</div></div>\n";
+        file << "            <div class=\"stat-card\"><div class=\"icon\">📈</div>\n";
+        file << "                <div class=\"label\">Peak Usage</div>\n";
+        file << "                <div class=\"value\">" << (peakMemoryUsage.load() / 1024.0) << " KB</div></div>\n";
+        file << "            <div class=\"stat-card\"><div class=\"icon\">⚠️</div>\n";
+        file << "                <div class=\"label\">Memory Leaks</div>\n";
+        file << "                <div class=\"value\">" << leakCount << "</div></div>\n";
+        file << "            <div class=\"stat-card\"><div class=\"icon\">🎯</div>\n";
+        file << "                <div class=\"label\">Active Allocations</div>\n";
+        file << "                <div class=\"value\">" << (totalAllocs - totalDeallocs) << "</div></div>\n";
+        file << "            <div class=\"stat-card\"><div class=\"icon\">🧰</div>\n";
+        file << "                <div class=\"label\">Profiler Memory (not counted above)</div>\n";
+        file << "                <div class=\"value\">" << (profilerMemoryUsed() / 1024.0) << " KB</div>\n";
+        file << "                <div class=\"label\">" << (profilerMemoryMapped() / 1024.0) << " KB mapped, "
+             << droppedRecords.load() << " records dropped</div></div>\n";
+        file << "        </div>\n";
+        
+        // Leak Alert
+        if (leakRecords > 0) {
+            std::string alertClass = leakedBytes > 10240 ? "leak-alert leak-critical" : "leak-alert";
+            file << "        <div class=\"" << alertClass << "\">\n";
+            file << "            <h3>⚠️ Memory Leak Detected!</h3>\n";
+            file << "            <p><strong>" << leakCount << "</strong> allocations were not freed, totaling <strong>" 
+                 << (leakedBytes / 1024.0) << " KB</strong> of leaked memory.</p>\n";
+            file << "        </div>\n";
+        } else {
+            file << "        <div class=\"leak-alert\" style=\"background: #d4edda; border-color: #28a745;\">\n";
+            file << "            <h3>✅ No Memory Leaks Detected!</h3>\n";
+            file << "            <p>All allocations have been properly freed.</p>\n";
+            file << "        </div>\n";
+        }
+        
+        std::vector<uint32_t> rowOf;
+        std::vector<uint32_t> rows;
+        groupSites(rowOf, rows);
+        
+        // Usage Over Time
+        std::vector<TimelinePoint> points;
+        {
+            std::lock_guard<std::mutex> guard(timelineMutex);
+            points.assign(timeline, timeline + timelineSize);
+        }
+        if (!points.empty()) {
+            TimelinePoint now = {monotonicNanos(), usage};
+            points.push_back(now);
+            writeTimelineChart(file, points);
+        }
+        
+        // Live at Peak
+        refreshPeakSnapshot(usage, monotonicNanos());
+        std::vector<LeakTotals> peakRows(rows.size(), LeakTotals());
+        size_t snapshotBytes;
+        uint64_t snapshotNanos;
+        peakLock.lock();
+        for (size_t id = 0; id < peakSites.size() && id < rowOf.size(); id++) {
+            peakRows[rowOf[id]].count += peakSites[id].count;
+            peakRows[rowOf[id]].bytes += peakSites[id].bytes;
+        }
+        snapshotBytes = peakSnapshotBytes;
+        snapshotNanos = peakSnapshotNanos;
+        peakLock.unlock();
+        if (snapshotBytes > 0) {
+            std::vector<size_t> bytesByRow(peakRows.size());
+            std::vector<uint32_t> order;
+            for (uint32_t r = 0; r < peakRows.size(); r++) {
+                bytesByRow[r] = peakRows[r].bytes;
+                if (peakRows[r].count > 0) {
+                    order.push_back(r);
+                }
+            }
+            size_t shown = selectTop(order, bytesByRow, reportRows);
+            
+            file << "        <div class=\"section\">\n";
+            file << "            <h2>⛰️ Live at Peak</h2>\n";
+            file << "            <p>Snapshot of " << (snapshotBytes / 1024.0) << " KB live, taken "
+                 << secondsSinceStart(snapshotNanos) << " s after start; the highest peak was "
+                 << (peakMemoryUsage.load() / 1024.0) << " KB.</p>\n";
+            file << "            <table><thead><tr><th>Location</th><th>Live Allocations</th>\n";
+            file << "                <th>Live Memory</th><th>Share</th></tr></thead><tbody>\n";
+            for (size_t i = 0; i < shown; i++) {
+                const LeakTotals& totals = peakRows[order[i]];
+                file << "                    <tr><td><code>" << htmlEscape(siteName(rows[order[i]])) << "</code>";
+                writeStackDetails(file, siteStack(rows[order[i]]));
+                file << "</td><td>" << totals.count << "</td><td>" << (totals.bytes / 1024.0) << " KB</td><td>"
+                     << (totals.bytes * 100.0 / snapshotBytes) << "%</td></tr>\n";
+            }
+            if (shown < order.size()) {
+                size_t restBytes = 0;
+                for (size_t i = shown; i < order.size(); i++) {
+                    restBytes += peakRows[order[i]].bytes;
+                }
+                file << "                    <tr><td><em>" << (order.size() - shown) << " more sites</em></td><td></td><td>"
+                     << (restBytes / 1024.0) << " KB</td><td>" << (restBytes * 100.0 / snapshotBytes) << "%</td></tr>\n";
+            }
+            file << "                </tbody></table></div>\n";
+        }
+        
+        // Leaks by Site
+        if (leakRecords > 0) {
+            std::vector<LeakTotals> rowLeaks(rows.size() + 1, LeakTotals());
+            for (size_t id = 0; id < leakSites.size(); id++) {
+                LeakTotals& totals = rowLeaks[id < rowOf.size() ? rowOf[id] : rows.size()];
+                totals.count += leakSites[id].count;
+                totals.bytes += leakSites[id].bytes;
+            }
+            std::vector<size_t> leakedBytesByRow(rowLeaks.size());
+            std::vector<uint32_t> order;
+            for (uint32_t r = 0; r < rowLeaks.size(); r++) {
+                leakedBytesByRow[r] = rowLeaks[r].bytes;
+                if (rowLeaks[r].count > 0) {
+                    order.push_back(r);
+                }
+            }
+            size_t shown = selectTop(order, leakedBytesByRow, reportRows);
+            
+            file << "        <div class=\"section\">\n";
+            file << "            <h2>🧭 Leaks by Site</h2>\n";
+            file << "            <table><thead><tr><th>Location</th><th>Leaked Allocations</th>\n";
+            file << "                <th>Leaked Memory</th></tr></thead><tbody>\n";
+            for (size_t i = 0; i < shown; i++) {
+                uint32_t siteId = order[i] < rows.size() ? rows[order[i]] : CallSiteTable::NO_ID;
+                file << "                    <tr><td><code>" << htmlEscape(siteName(siteId)) << "</code>";
+                writeStackDetails(file, siteStack(siteId));
+                file << "</td><td>" << rowLeaks[order[i]].count << "</td><td>"
+                     << (rowLeaks[order[i]].bytes / 1024.0) << " KB</td></tr>\n";
+            }
+            if (shown < order.size()) {
+                size_t restCount = 0;
+                size_t restBytes = 0;
+                for (size_t i = shown; i < order.size(); i++) {
+                    restCount += rowLeaks[order[i]].count;
+                    restBytes += rowLeaks[order[i]].bytes;
+                }
+                file << "                    <tr><td><em>" << (order.size() - shown) << " more sites</em></td><td>"
+                     << restCount << "</td><td>" << (restBytes / 1024.0) << " KB</td></tr>\n";
+            }
+            file << "                </tbody></table></div>\n";
+        }
+        
+        // Memory Leaks Table
+        if (!leakList.empty()) {
+            std::sort_heap(leakList.begin(), leakList.end(), largerAllocation);
+            file << "        <div class=\"section\">\n";
+            file << "            <h2>🔴 Detected Memory Leaks</h2>\n";
+            if (leakList.size() < leakRecords) {
+                file << "            <p>Showing the " << leakList.size() << " largest of " << leakRecords
+                     << (getSamplingInterval() != 0 ? " sampled" : "") << " allocations that are still live.</p>\n";
+            } else if (getSamplingInterval() != 0) {
+                file << "            <p>Showing the " << leakList.size() << " sampled allocations that are still live.</p>\n";
+            }
+            file << "            <table><thead><tr><th>Address</th><th>Size</th><th>Location</th>\n";
+            file << "                <th>Timestamp</th><th>Thread ID</th><th>Severity</th></tr></thead><tbody>\n";
+            
+            for (size_t i = 0; i < leakList.size(); i++) {
+                const AllocationInfo& leak = leakList[i];
+                std::string severity = leak.size > 1024 ? "Major" : "Minor";
+                std::string badgeClass = leak.size > 1024 ? "badge-danger" : "badge-warning";
+                
+                file << "                    <tr><td><code>" << leak.address << "</code></td>\n";
+                file << "                        <td>" << leak.size << " bytes</td>\n";
+                file << "                        <td>" << htmlEscape(siteName(leak.siteId));
+                writeStackDetails(file, siteStack(leak.siteId));
+                file << "</td>\n";
+                file << "                        <td>" << formatTimestamp(leak.timestamp) << "</td><td>" << leak.threadId << "</td>\n";
+                file << "                        <td><span class=\"badge " << badgeClass << "\">" 
+                     << severity << "</span></td></tr>\n";
+            }
+            
+            file << "                </tbody></table></div>\n";
+            std::make_heap(leakList.begin(), leakList.end(), largerAllocation);
+        }
+        
+        // Allocation Sites
+        file << "        <div class=\"section\"><h2>📍 Top Allocation Sites</h2>\n";
+        file << "            <table><thead><tr><th>Location</th><th>Allocation Count</th>\n";
+        file << "                <th>Frequency</th></tr></thead><tbody>\n";
+        
+        std::vector<size_t> rowAllocations(rows.size());
+        std::vector<uint32_t> order(rows.size());
+        for (uint32_t id = 0; id < rowOf.size(); id++) {
+            rowAllocations[rowOf[id]] += callSites.get(id).allocations.load(std::memory_order_relaxed);
+        }
+        for (uint32_t r = 0; r < rows.size(); r++) {
+            order[r] = r;
+        }
+        size_t displayCount = selectTop(order, rowAllocations, 10);
+        for (size_t i = 0; i < displayCount; i++) {
+            size_t allocations = rowAllocations[order[i]];
+            double percentage = (allocations * 100.0) / totalAllocs;
+            file << "                    <tr><td><code>" << htmlEscape(siteName(rows[order[i]])) << "</code>";
+            writeStackDetails(file, siteStack(rows[order[i]]));
+            file << "</td>\n";
+            file << "                        <td>" << allocations << "</td><td>\n";
+            file << "                            <div class=\"progress-bar\" style=\"height: 20px;\">\n";
+            file << "                                <div class=\"progress-fill\" style=\"width: " 
+                 << percentage << "%; font-size: 0.8em;\">" << percentage << "%</div></div></td></tr>\n";
+        }
+        
+        file << "                </tbody></table></div>\n";
+        
+        writeHeapErrors(file);
+        writeThreadSections(file);
+        writeSnapshotSections(file);
+        writeSizesAndLifetimes(file);
+        writePoolCandidates(file, rowOf, rows);
+        file << "    </div></body></html>\n";
+        
+        file.close();
+        (*logStream) << "\n HTML report generated: " << filename << std::endl;
+        (*logStream) << "Open it with: start " << filename << "\n\n";
+    }
+    
+    // Writes every call site as a pprof heap profile (uncompressed
+    // profile.proto) with allocations, bytes allocated, and live
+    // allocations and bytes per call stack, for `pprof` and flame graph
+    // tools. Returns false if the file cannot be written.
+    bool exportPprof(const std::string& filename) {
+        ProfilerScope scope;
+        flushSiteBatches();
+        std::vector<char> buffer(size_t(1) << 20);
+        std::ofstream file;
+        file.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        file.open(filename.c_str(), std::ios::binary);
+        if (!file) {
+            return false;
+        }
+        
+        ProfileTotals totals = {1, totalAllocations(), totalDeallocations(), currentUsage(),
+                                peakMemoryUsage.load()};
+        PprofWriter writer(file);
+        writer.totals(totals);
+        std::vector<ProfileFrame> frames;
+        int64_t values[PROFILE_VALUES];
+        for (uint32_t id = 0; id < callSites.size(); id++) {
+            const CallSite& site = callSites.get(id);
+            if (site.allocations.load(std::memory_order_relaxed) == 0) {
+                continue;
+            }
+            siteFrames(id, frames);
+            siteValues(site, values);
+            writer.sample(frames, values);
+        }
+        writer.finish(static_cast<int64_t>(startWallClock) * 1000000000LL,
+                      static_cast<int64_t>(monotonicNanos() - startNanos));
+        file.close();
+        return !file.fail();
+    }
+    
+    // Writes the same per-site values as compact JSON, one site per line,
+    // with the process totals in front; memprof_merge combines these files
+    // from many processes.
+    bool exportJson(const std::string& filename) {
+        ProfilerScope scope;
+        flushSiteBatches();
+        std::vector<char> buffer(size_t(1) << 20);
+        std::ofstream file;
+        file.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        file.open(filename.c_str(), std::ios::binary);
+        if (!file) {
+            return false;
+        }
+        
+        ProfileTotals totals = {1, totalAllocations(), totalDeallocations(), currentUsage(),
+                                peakMemoryUsage.load()};
+        JsonProfileWriter writer(file, totals);
+        std::vector<std::string> stack;
+        int64_t values[PROFILE_VALUES];
+        for (uint32_t id = 0; id < callSites.size(); id++) {
+            const CallSite& site = callSites.get(id);
+            if (site.allocations.load(std::memory_order_relaxed) == 0) {
+                continue;
+            }
+            stack.clear();
+            if (site.key.stackId != StackTable::NO_ID) {
+                const StackKey& frames = stacks.get(site.key.stackId).key;
+                for (uint32_t i = 0; i < frames.depth; i++) {
+                    stack.push_back(symbolize(frames.frames[i]));
+                }
+            }
+            siteValues(site, values);
+            writer.site(siteName(id), stack, values);
+        }
+        writer.finish();
+        file.close();
+        return !file.fail();
+    }
+    
+    void printSummary() {
+        ProfilerScope scope;
+        (*logStream) << "\n========================================\n";
+        (*logStream) << "    MEMORY PROFILER SUMMARY\n";
+        (*logStream) << "========================================\n\n";
+        (*logStream) << "Total Allocations:   " << totalAllocations() << "\n";
+        (*logStream) << "Total Deallocations: " << totalDeallocations() << "\n";
+        (*logStream) << "Current Usage:       " << (currentUsage() / 1024.0) << " KB\n";
+        (*logStream) << "Peak Usage:          " << (peakMemoryUsage.load() / 1024.0) << " KB at "
+                     << secondsSinceStart(peakNanos.load()) << " s\n";
+        (*logStream) << "Memory Leaks:        " << leakCount << "\n";
+        if (Policy::leakTracking && Policy::threadIds) {
+            size_t remoteFrees = 0;
+            for (ThreadCounters* t = threadList.load(std::memory_order_acquire); t; t = t->next) {
+                for (RemoteFrees* cell = t->outgoing.load(std::memory_order_acquire); cell; cell = cell->nextOutgoing) {
+                    remoteFrees += cell->count.load(std::memory_order_relaxed);
+                }
+            }
+            (*logStream) << "Threads:             " << threadsThatAllocated() << " (" << remoteFrees << " cross-thread frees)\n";
+        }
+        if (getSamplingInterval() != 0) {
+            (*logStream) << "Sampling Interval:   " << getSamplingInterval() << " bytes (figures above are estimates)\n";
+        }
+        if (isStreaming()) {
+            (*logStream) << "Streaming To:        " << tracePath << " (usage and leaks are in the trace)\n";
+        }
+        (*logStream) << "Profiler Memory:     " << (profilerMemoryUsed() / 1024.0) << " KB ("
+                  << (profilerMemoryMapped() / 1024.0) << " KB mapped)\n";
+        if (droppedRecords.load() > 0) {
+            (*logStream) << "Dropped Records:     " << droppedRecords.load() << "\n";
+        }
+        if (getQuarantineBudget() != 0 || heapErrorTotal() != 0) {
+            (*logStream) << "Heap Errors:         " << heapErrorTotal() << " (" << heapErrorCount(DOUBLE_FREE)
+                         << " double, " << heapErrorCount(INVALID_FREE) << " invalid, "
+                         << heapErrorCount(MISMATCHED_FREE) << " mismatched frees, "
+                         << heapErrorCount(WRITE_AFTER_FREE) << " writes after free)\n";
+        }
+        (*logStream) << "========================================\n\n";
+    }
+};
+
+// Policy of the profiler behind the hooks below and of the MemoryProfiler
+// name. To use another, include memprof_policy.h, declare the policy and
+// define MEMPROF_POLICY to it before including this header, the same way
+// in every translation unit; MEMPROF_DISABLED selects DisabledProfilerPolicy.
+#ifndef MEMPROF_POLICY
+#ifdef MEMPROF_DISABLED
+#define MEMPROF_POLICY DisabledProfilerPolicy
+#else
+#define MEMPROF_POLICY DefaultProfilerPolicy
+#endif
+#endif
+
+typedef BasicMemoryProfiler<MEMPROF_POLICY> MemoryProfiler;
+
+// Allocation entry point shared by every operator new below. Follows the
+// standard new-handler loop; nothrow forms return NULL instead of throwing.
+inline void* memprofAllocate(size_t size, size_t alignment, bool nothrow, const char* file, int line,
+                             const void* caller, AllocationKind kind) {
+    if (size == 0) {
+        size = 1;
+    }
+    for (;;) {
+        void* ptr = NULL;
+        if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            ptr = malloc(size);
+        } else {
+#ifdef _WIN32
+            ptr = _aligned_malloc(size, alignment);
+#else
+            if (posix_memalign(&ptr, alignment, size) != 0) {
+                ptr = NULL;
+            }
+#endif
+        }
+        if (ptr) {
+            if constexpr (MEMPROF_POLICY::enabled) {
+                MemoryProfiler::getInstance().recordAllocation(ptr, size, file, line, caller, kind);
+            } else {
+                (void)file;
+                (void)line;
+                (void)caller;
+                (void)kind;
+            }
+            return ptr;
+        }
+        
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            if (nothrow) {
+                return NULL;
+            }
+            throw std::bad_alloc();
+        }
+        if (nothrow) {
+            try {
+                handler();
+            } catch (...) {
+                return NULL;
+            }
+        } else {
+            handler();
+        }
+    }
+}
+
+// A block the profiler keeps in its quarantine, or rejects as a bad free,
+// is not released here.
+inline void memprofDeallocate(void* ptr, bool aligned, AllocationKind kind, const void* caller) {
+    if (ptr) {
+        if constexpr (MEMPROF_POLICY::enabled) {
+            if (!MemoryProfiler::getInstance().recordDeallocation(ptr, kind, caller)) {
+                return;
+            }
+        } else {
+            (void)kind;
+            (void)caller;
+        }
+#ifdef _WIN32
+        if (aligned) {
+            _aligned_free(ptr);
+            return;
+        }
+#else
+        (void)aligned;
+#endif
+        free(ptr);
+    }
+}
+
+// Allocations made through the `new` macro below carry their file and line.
+// Kept out of line so the return address is the allocating code's.
+MEMPROF_NOINLINE inline void* operator new(size_t size, const char* file, int line) {
+    return memprofAllocate(size, 0, false, file, line, MEMPROF_CALLER(), ALLOC_NEW);
+}
+
+MEMPROF_NOINLINE inline void* operator new[](size_t size, const char* file, int line) {
+    return memprofAllocate(size, 0, false, file, line, MEMPROF_CALLER(), ALLOC_NEW_ARRAY);
+}
+
+// Called only when a constructor throws inside a macro `new` expression.
+inline void operator delete(void* ptr, const char*, int) noexcept {
+    memprofDeallocate(ptr, false, ALLOC_NEW, MEMPROF_CALLER());
+}
+
+inline void operator delete[](void* ptr, const char*, int) noexcept {
+    memprofDeallocate(ptr, false, ALLOC_NEW_ARRAY, MEMPROF_CALLER());
+}
+
+// Replacements for every global allocation function, so allocations from
+// the standard library, other libraries and translation units that never
+// see the macro are tracked too, each under its caller's address.
+// Replacement functions cannot be inline: exactly one translation unit of
+// a program may define them, every other one includes this header with
+// MEMPROF_NO_GLOBAL_HOOKS defined.
+#ifndef MEMPROF_NO_GLOBAL_HOOKS
+
+void* operator new(size_t size) {
+    return memprofAllocate(size, 0, false, NULL, 0, MEMPROF_CALLER(), ALLOC_NEW);
+}
+
+void* operator new[](size_t size) {
+    return memprofAllocate(size, 0, false, NULL, 0, MEMPROF_CALLER(), ALLOC_NEW_ARRAY);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return memprofAllocate(size, 0, true, NULL, 0, MEMPROF_CALLER(), ALLOC_NEW);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return memprofAllocate(size, 0, true, NULL, 0, MEMPROF_CALLER(), ALLOC_NEW_ARRAY);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return memprofAllocate(size, static_cast<size_t>(alignment), false, NULL, 0, MEMPROF_CALLER(), ALLOC_NEW);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return memprofAllocate(size, static_cast<size_t>(alignment), false, NULL, 0, MEMPROF_CALLER(),
+                           ALLOC_NEW_ARRAY);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return memprofAllocate(size, static_cast<size_t>(alignment), true, NULL, 0, MEMPROF_CALLER(), ALLOC_NEW);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return memprofAllocate(size, static_cast<size_t>(alignment), true, NULL, 0, MEMPROF_CALLER(),
+                           ALLOC_NEW_ARRAY);
+}
+
+void operator delete(void* ptr) noexcept {
+    memprofDeallocate(ptr, false, ALLOC_NEW, MEMPROF_CALLER());
+}
+
+void operator delete[](void* ptr) noexcept {
+    memprofDeallocate(ptr, false, ALLOC_NEW_ARRAY, MEMPROF_CALLER());
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    memprofDeallocate(ptr, false, ALLOC_NEW, MEMPROF_CALLER());
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    memprofDeallocate(ptr, false, ALLOC_NEW_ARRAY, MEMPROF_CALLER());
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    memprofDeallocate(ptr, false, ALLOC_NEW, MEMPROF_CALLER());
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    memprofDeallocate(ptr, false, ALLOC_NEW_ARRAY, MEMPROF_CALLER());
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    memprofDeallocate(ptr, true, ALLOC_NEW, MEMPROF_CALLER());
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    memprofDeallocate(ptr, true, ALLOC_NEW_ARRAY, MEMPROF_CALLER());
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+    memprofDeallocate(ptr, true, ALLOC_NEW, MEMPROF_CALLER());
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept {
+    memprofDeallocate(ptr, true, ALLOC_NEW_ARRAY, MEMPROF_CALLER());
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    memprofDeallocate(ptr, true, ALLOC_NEW, MEMPROF_CALLER());
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    memprofDeallocate(ptr, true, ALLOC_NEW_ARRAY, MEMPROF_CALLER());
+}
+
+#endif
+
+#ifndef MEMPROF_NO_NEW_MACRO
+#define new new(__FILE__, __LINE__)
+#endif
+
+#endif 
+
@@ -0,0 +1,285 @@
+// Offline analyzer for the trace written by MemoryProfiler::startStreaming
+// (or by libmemprof.so with MEMPROF_TRACE set). Replays the trace and
+// prints peak usage, the allocations still live at the end, and per-site
+// statistics.
+//
+//     make memprof_analyze
+//     ./memprof_analyze trace.bin [--top N]
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include "memprof_trace.h"
+
+struct SiteStats {
+    std::string name;
+    double allocations;
+    double bytes;
+    double liveCount;
+    double liveBytes;
+};
+
+struct LiveBlock {
+    uint64_t size;
+    uint32_t site;
+    uint64_t timestamp;
+};
+
+// Frees can reach the file ahead of the allocation they release when the
+// two happened on different threads. A free of an unknown address waits
+// here for this long before it is treated as a free of untraced memory.
+static const uint64_t REORDER_WINDOW_NANOS = 1000000000ULL;
+
+class TraceAnalyzer {
+private:
+    TraceHeader header;
+    std::vector<SiteStats> sites;
+    std::unordered_map<std::string, uint32_t> siteByName;
+    std::vector<uint32_t> siteById;
+    std::unordered_map<uint64_t, LiveBlock> live;
+    std::unordered_map<uint64_t, uint64_t> pendingFrees;
+    
+    uint64_t events;
+    uint64_t firstTimestamp;
+    uint64_t lastTimestamp;
+    double allocations;
+    double frees;
+    double unmatchedFrees;
+    double currentBytes;
+    double peakBytes;
+    uint64_t peakTimestamp;
+    
+    // Same estimate the profiler uses: a sample of this size stands for
+    // 1/p allocations.
+    double weight(uint64_t size) const {
+        if (header.samplingInterval == 0) {
+            return 1.0;
+        }
+        double bytes = static_cast<double>(size == 0 ? 1 : size);
+        return 1.0 / -std::expm1(-bytes / static_cast<double>(header.samplingInterval));
+    }
+    
+    uint32_t siteFor(uint32_t id) {
+        if (id < siteById.size() && siteById[id] != UINT32_MAX) {
+            return siteById[id];
+        }
+        return defineSite(id, "unknown\n");
+    }
+    
+    uint32_t defineSite(uint32_t id, const std::string& name) {
+        std::unordered_map<std::string, uint32_t>::iterator it = siteByName.find(name);
+        uint32_t index;
+        if (it != siteByName.end()) {
+            index = it->second;
+        } else {
+            index = static_cast<uint32_t>(sites.size());
+            SiteStats stats = {name, 0, 0, 0, 0};
+            sites.push_back(stats);
+            siteByName[name] = index;
+        }
+        if (id != UINT32_MAX) {
+            if (id >= siteById.size()) {
+                siteById.resize(id + 1, UINT32_MAX);
+            }
+            siteById[id] = index;
+        }
+        return index;
+    }
+    
+    void release(const LiveBlock& block) {
+        double w = weight(block.size);
+        currentBytes -= block.size * w;
+        sites[block.site].liveCount -= w;
+        sites[block.site].liveBytes -= block.size * w;
+        frees += w;
+    }
+    
+    void onAlloc(const TraceEvent& event) {
+        std::unordered_map<uint64_t, uint64_t>::iterator pending = pendingFrees.find(event.address);
+        LiveBlock block = {event.size, siteFor(event.siteId), event.timestamp};
+        double w = weight(event.size);
+        allocations += w;
+        sites[block.site].allocations += w;
+        sites[block.site].bytes += event.size * w;
+        if (pending != pendingFrees.end() && pending->second >= event.timestamp) {
+            // Its free was flushed first; the block was never live here.
+            pendingFrees.erase(pending);
+            frees += w;
+            return;
+        }
+        
+        std::unordered_map<uint64_t, LiveBlock>::iterator it = live.find(event.address);
+        if (it != live.end()) {
+            // The free of the previous block at this address was lost.
+            release(it->second);
+            it->second = block;
+        } else {
+            live[event.address] = block;
+        }
+        currentBytes += event.size * w;
+        sites[block.site].liveCount += w;
+        sites[block.site].liveBytes += event.size * w;
+        if (currentBytes > peakBytes) {
+            peakBytes = currentBytes;
+            peakTimestamp = event.timestamp;
+        }
+    }
+    
+    void onFree(const TraceEvent& event) {
+        std::unordered_map<uint64_t, LiveBlock>::iterator it = live.find(event.address);
+        if (it != live.end() && it->second.timestamp <= event.timestamp) {
+            release(it->second);
+            live.erase(it);
+        } else {
+            pendingFrees[event.address] = event.timestamp;
+        }
+    }
+    
+    void expirePendingFrees() {
+        for (std::unordered_map<uint64_t, uint64_t>::iterator it = pendingFrees.begin(); it != pendingFrees.end();) {
+            if (it->second + REORDER_WINDOW_NANOS < lastTimestamp) {
+                unmatchedFrees++;
+                it = pendingFrees.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    
+    static std::string formatBytes(double bytes) {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%.1f KB", bytes / 1024.0);
+        return buffer;
+    }
+    
+    static std::string firstLine(const std::string& name) {
+        return name.substr(0, name.find('\n'));
+    }
+    
+    void printSites(std::vector<uint32_t> order, size_t top, double SiteStats::*key, const char* title) {
+        size_t count = std::min(top, order.size());
+        std::partial_sort(order.begin(), order.begin() + count, order.end(),
+                          [this, key](uint32_t a, uint32_t b) { return sites[a].*key > sites[b].*key; });
+        std::cout << title << "\n";
+        for (size_t i = 0; i < count && sites[order[i]].*key > 0; i++) {
+            const SiteStats& site = sites[order[i]];
+            std::cout << "  " << firstLine(site.name) << "\n";
+            std::cout << "      " << std::llround(site.allocations) << " allocations, " << formatBytes(site.bytes)
+                      << " allocated, " << std::llround(site.liveCount) << " live (" << formatBytes(site.liveBytes)
+                      << ")\n";
+        }
+        std::cout << "\n";
+    }
+    
+public:
+    TraceAnalyzer() : events(0), firstTimestamp(0), lastTimestamp(0), allocations(0), frees(0),
+                      unmatchedFrees(0), currentBytes(0), peakBytes(0), peakTimestamp(0) {
+        memset(&header, 0, sizeof(header));
+    }
+    
+    bool load(const std::string& path) {
+        std::ifstream in(path.c_str(), std::ios::binary);
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+            std::cerr << "[ERROR] " << path << " is not a memory profiler trace\n";
+            return false;
+        }
+        if (header.version != TRACE_VERSION || header.eventSize != sizeof(TraceEvent)) {
+            std::cerr << "[ERROR] Unsupported trace version " << header.version << "\n";
+            return false;
+        }
+        
+        TraceEvent event;
+        while (in.read(reinterpret_cast<char*>(&event), sizeof(event))) {
+            TraceEventType type = event.type();
+            if (type == TRACE_END) {
+                break;
+            }
+            if (type == TRACE_SITE) {
+                std::string name(static_cast<size_t>(event.size), '\0');
+                in.read(&name[0], static_cast<std::streamsize>(name.size()));
+                in.ignore(static_cast<std::streamsize>((sizeof(TraceEvent) - name.size() % sizeof(TraceEvent)) %
+                                                       sizeof(TraceEvent)));
+                defineSite(event.siteId, name);
+                continue;
+            }
+            
+            events++;
+            if (firstTimestamp == 0) {
+                firstTimestamp = event.timestamp;
+            }
+            lastTimestamp = std::max(lastTimestamp, event.timestamp);
+            if (type == TRACE_ALLOC) {
+                onAlloc(event);
+            } else if (type == TRACE_FREE) {
+                onFree(event);
+            }
+            if ((events & 0xfffff) == 0) {
+                expirePendingFrees();
+            }
+        }
+        unmatchedFrees += pendingFrees.size();
+        pendingFrees.clear();
+        return true;
+    }
+    
+    void print(size_t top) {
+        double leakCount = 0;
+        std::vector<uint32_t> order;
+        for (uint32_t i = 0; i < sites.size(); i++) {
+            leakCount += sites[i].liveCount;
+            order.push_back(i);
+        }
+        
+        std::cout << "\n========================================\n";
+        std::cout << "    MEMORY PROFILER TRACE ANALYSIS\n";
+        std::cout << "========================================\n\n";
+        std::cout << "Events:              " << events << "\n";
+        std::cout << "Duration:            " << (lastTimestamp - firstTimestamp) / 1e9 << " s\n";
+        std::cout << "Total Allocations:   " << std::llround(allocations) << "\n";
+        std::cout << "Total Deallocations: " << std::llround(frees) << "\n";
+        std::cout << "Peak Usage:          " << formatBytes(peakBytes) << " at +"
+                  << (peakTimestamp > header.startNanos ? (peakTimestamp - header.startNanos) / 1e9 : 0.0) << " s\n";
+        std::cout << "Memory Leaks:        " << std::llround(leakCount) << " (" << formatBytes(currentBytes) << ")\n";
+        if (unmatchedFrees > 0) {
+            std::cout << "Untraced Frees:      " << std::llround(unmatchedFrees) << "\n";
+        }
+        if (header.samplingInterval != 0) {
+            std::cout << "Sampling Interval:   " << header.samplingInterval << " bytes (figures above are estimates)\n";
+        }
+        std::cout << "========================================\n\n";
+        
+        printSites(order, top, &SiteStats::liveBytes, "Leaks by site:");
+        printSites(order, top, &SiteStats::allocations, "Top allocation sites:");
+        printSites(order, top, &SiteStats::bytes, "Top sites by bytes:");
+    }
+};
+
+int main(int argc, char** argv) {
+    std::string path;
+    size_t top = 10;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--top" && i + 1 < argc) {
+            top = strtoul(argv[++i], NULL, 10);
+        } else {
+            path = arg;
+        }
+    }
+    if (path.empty()) {
+        std::cerr << "Usage: " << argv[0] << " trace.bin [--top N]\n";
+        return 1;
+    }
+    
+    TraceAnalyzer analyzer;
+    if (!analyzer.load(path)) {
+        return 1;
+    }
+    analyzer.print(top);
+    return 0;
+}
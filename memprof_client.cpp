@@ -0,0 +1,90 @@
+// Polls the introspection socket of a running process, started with
+// MemoryProfiler::startIntrospection or MEMPROF_SOCKET for libmemprof.so,
+// and prints each JSON reply on its own line.
+//
+//     make memprof_client
+//     ./memprof_client /tmp/app.sock [request] [--interval ms] [--count n]
+//
+// request is "stats", "sites [N]", "leaks [N]" or "all [N]" (the default),
+// or "snapshot NAME" and "diff FROM [TO]" to mark and compare heap states.
+// Without --interval the socket is queried once.
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+bool query(const std::string& path, const std::string& request, std::string& reply) {
+    sockaddr_un address;
+    if (path.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size());
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return false;
+    }
+    
+    std::string line = request + "\n";
+    if (send(fd, line.data(), line.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(line.size())) {
+        close(fd);
+        return false;
+    }
+    reply.clear();
+    char buffer[4096];
+    ssize_t received;
+    while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        reply.append(buffer, static_cast<size_t>(received));
+    }
+    close(fd);
+    return !reply.empty();
+}
+
+int main(int argc, char** argv) {
+    std::string path;
+    std::string request;
+    long interval = 0;
+    long count = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--interval" && i + 1 < argc) {
+            interval = atol(argv[++i]);
+        } else if (arg == "--count" && i + 1 < argc) {
+            count = atol(argv[++i]);
+        } else if (path.empty()) {
+            path = arg;
+        } else {
+            request += (request.empty() ? "" : " ") + arg;
+        }
+    }
+    if (path.empty()) {
+        std::cerr << "Usage: " << argv[0] << " socket [request] [--interval ms] [--count n]\n";
+        return 1;
+    }
+    if (request.empty()) {
+        request = "all";
+    }
+    
+    for (long polls = 1;; polls++) {
+        std::string reply;
+        if (!query(path, request, reply)) {
+            std::cerr << "[ERROR] No reply from " << path << "\n";
+            return 1;
+        }
+        std::cout << reply << std::flush;
+        if (interval <= 0 || (count > 0 && polls >= count)) {
+            break;
+        }
+        usleep(static_cast<useconds_t>(interval) * 1000);
+    }
+    return 0;
+}
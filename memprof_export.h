@@ -0,0 +1,343 @@
+#ifndef MEMPROF_EXPORT_H
+#define MEMPROF_EXPORT_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <ostream>
+
+// Machine-readable profiles written by MemoryProfiler::exportPprof and
+// exportJson, and read and written by memprof_merge. Both hold the same
+// four values per call stack: allocations and bytes allocated over the
+// run, and allocations and bytes still live.
+//
+// The pprof output is an uncompressed profile.proto message, which pprof
+// and flame graph tools accept as is. Messages are encoded one at a time
+// and written straight to the stream, with the string table last.
+
+static const size_t PROFILE_VALUES = 4;
+static const char* const PROFILE_SAMPLE_TYPES[PROFILE_VALUES] = {"alloc_objects", "alloc_space", "inuse_objects",
+                                                                 "inuse_space"};
+static const char* const PROFILE_SAMPLE_UNITS[PROFILE_VALUES] = {"count", "bytes", "count", "bytes"};
+static const char* const PROFILE_JSON_KEYS[PROFILE_VALUES] = {"allocations", "bytes", "live", "live_bytes"};
+static const char* const PROFILE_JSON_FORMAT = "memprof-profile-1";
+
+// Process-wide figures, kept in the JSON format and as pprof comments;
+// memprof_merge sums them.
+struct ProfileTotals {
+    uint64_t processes;
+    uint64_t allocations;
+    uint64_t deallocations;
+    uint64_t liveBytes;
+    uint64_t peakBytes;
+};
+
+static const size_t PROFILE_TOTALS = 5;
+static const char* const PROFILE_TOTAL_KEYS[PROFILE_TOTALS] = {"processes", "allocations", "deallocations",
+                                                               "live_bytes", "peak_bytes"};
+static uint64_t ProfileTotals::* const PROFILE_TOTAL_FIELDS[PROFILE_TOTALS] = {
+    &ProfileTotals::processes, &ProfileTotals::allocations, &ProfileTotals::deallocations, &ProfileTotals::liveBytes,
+    &ProfileTotals::peakBytes};
+static const char* const PROFILE_COMMENT_PREFIX = "memprof.";
+
+// One frame of a call stack: the function, its file (the source file, or
+// the module when only the symbol is known), the line when known and the
+// code address, 0 once it no longer means anything.
+struct ProfileFrame {
+    std::string function;
+    std::string file;
+    int64_t line;
+    uint64_t address;
+};
+
+// Splits a symbolized address of the form "function+0x1f (module)" into
+// function and module. Other names are kept whole as the function.
+inline ProfileFrame frameFromSymbol(const std::string& symbol, uint64_t address) {
+    ProfileFrame frame = {symbol, "", 0, address};
+    size_t open = symbol.rfind(" (");
+    size_t offset = open == std::string::npos ? std::string::npos : symbol.rfind("+0x", open);
+    if (offset != std::string::npos && symbol[symbol.size() - 1] == ')') {
+        frame.function = symbol.substr(0, offset);
+        frame.file = symbol.substr(open + 2, symbol.size() - open - 3);
+    }
+    return frame;
+}
+
+// Name of a frame in the JSON format and in merged output.
+inline std::string frameLabel(const ProfileFrame& frame) {
+    if (frame.line > 0 && !frame.file.empty()) {
+        return frame.file + ":" + std::to_string(frame.line);
+    }
+    return frame.function;
+}
+
+// Encoder for one protobuf message of bounded size, so messages can be
+// written one at a time with their length in front.
+class ProtoBuffer {
+private:
+    static const size_t CAPACITY = 2048;
+    
+    unsigned char bytes[CAPACITY];
+    size_t length;
+    
+    void put(unsigned char byte) {
+        if (length < CAPACITY) {
+            bytes[length] = byte;
+        }
+        length++;
+    }
+
+public:
+    ProtoBuffer() : length(0) {}
+    
+    void varint(uint64_t value) {
+        while (value >= 0x80) {
+            put(static_cast<unsigned char>(value | 0x80));
+            value >>= 7;
+        }
+        put(static_cast<unsigned char>(value));
+    }
+    
+    // Zero is the default of every scalar field and is left out.
+    void field(uint32_t number, uint64_t value) {
+        if (value != 0) {
+            varint(uint64_t(number) << 3);
+            varint(value);
+        }
+    }
+    
+    void packed(uint32_t number, const uint64_t* values, size_t count) {
+        if (count == 0) {
+            return;
+        }
+        size_t size = 0;
+        for (size_t i = 0; i < count; i++) {
+            uint64_t value = values[i];
+            do {
+                size++;
+                value >>= 7;
+            } while (value != 0);
+        }
+        varint((uint64_t(number) << 3) | 2);
+        varint(size);
+        for (size_t i = 0; i < count; i++) {
+            varint(values[i]);
+        }
+    }
+    
+    void message(uint32_t number, const ProtoBuffer& inner) {
+        varint((uint64_t(number) << 3) | 2);
+        varint(inner.size());
+        for (size_t i = 0; i < inner.size(); i++) {
+            put(inner.bytes[i]);
+        }
+    }
+    
+    // False if the message did not fit and must not be written.
+    bool complete() const { return length <= CAPACITY; }
+    size_t size() const { return length < CAPACITY ? length : CAPACITY; }
+    
+    void writeRaw(std::ostream& out) const {
+        out.write(reinterpret_cast<const char*>(bytes), static_cast<std::streamsize>(size()));
+    }
+    
+    // Writes the message as field `number` of the enclosing message.
+    void writeTo(std::ostream& out, uint32_t number) const {
+        ProtoBuffer header;
+        header.varint((uint64_t(number) << 3) | 2);
+        header.varint(size());
+        header.writeRaw(out);
+        writeRaw(out);
+    }
+};
+
+// Streams a pprof heap profile. Functions and locations are written when
+// first used, deduplicated by name and address; strings are only indexed
+// until finish() writes the table.
+class PprofWriter {
+private:
+    // Profile fields of profile.proto.
+    enum {
+        SAMPLE_TYPE = 1,
+        SAMPLE = 2,
+        LOCATION = 4,
+        FUNCTION = 5,
+        STRING_TABLE = 6,
+        TIME_NANOS = 9,
+        DURATION_NANOS = 10,
+        COMMENT = 13
+    };
+    
+    std::ostream& out;
+    std::unordered_map<std::string, uint64_t> strings;
+    std::vector<const std::string*> stringOrder;
+    std::unordered_map<std::string, uint64_t> functions;
+    std::unordered_map<std::string, uint64_t> locations;
+    
+    uint64_t stringIndex(const std::string& text) {
+        std::unordered_map<std::string, uint64_t>::iterator it = strings.find(text);
+        if (it != strings.end()) {
+            return it->second;
+        }
+        it = strings.insert(std::make_pair(text, static_cast<uint64_t>(stringOrder.size()))).first;
+        stringOrder.push_back(&it->first);
+        return it->second;
+    }
+    
+    uint64_t functionId(const ProfileFrame& frame) {
+        std::string key = frame.function + '\0' + frame.file;
+        std::unordered_map<std::string, uint64_t>::iterator it = functions.find(key);
+        if (it != functions.end()) {
+            return it->second;
+        }
+        uint64_t id = functions.size() + 1;
+        functions[key] = id;
+        ProtoBuffer function;
+        function.field(1, id);
+        function.field(2, stringIndex(frame.function));
+        function.field(3, stringIndex(frame.function));
+        function.field(4, stringIndex(frame.file));
+        function.writeTo(out, FUNCTION);
+        return id;
+    }
+
+public:
+    explicit PprofWriter(std::ostream& stream) : out(stream) {
+        stringIndex("");
+        for (size_t i = 0; i < PROFILE_VALUES; i++) {
+            ProtoBuffer type;
+            type.field(1, stringIndex(PROFILE_SAMPLE_TYPES[i]));
+            type.field(2, stringIndex(PROFILE_SAMPLE_UNITS[i]));
+            type.writeTo(out, SAMPLE_TYPE);
+        }
+    }
+    
+    // Writes the totals as comments of the form "memprof.allocations=42".
+    void totals(const ProfileTotals& totals) {
+        for (size_t i = 0; i < PROFILE_TOTALS; i++) {
+            ProtoBuffer comment;
+            comment.field(COMMENT, stringIndex(std::string(PROFILE_COMMENT_PREFIX) + PROFILE_TOTAL_KEYS[i] + "=" +
+                                               std::to_string(totals.*PROFILE_TOTAL_FIELDS[i])));
+            comment.writeRaw(out);
+        }
+    }
+    
+    uint64_t locationId(const ProfileFrame& frame) {
+        char address[24];
+        snprintf(address, sizeof(address), "%llx", static_cast<unsigned long long>(frame.address));
+        std::string key = std::string(address) + '\0' + frame.function + '\0' + frame.file + '\0' +
+                          std::to_string(frame.line);
+        std::unordered_map<std::string, uint64_t>::iterator it = locations.find(key);
+        if (it != locations.end()) {
+            return it->second;
+        }
+        uint64_t function = functionId(frame);
+        uint64_t id = locations.size() + 1;
+        locations[key] = id;
+        ProtoBuffer line;
+        line.field(1, function);
+        line.field(2, static_cast<uint64_t>(frame.line));
+        ProtoBuffer location;
+        location.field(1, id);
+        location.field(3, frame.address);
+        location.message(4, line);
+        location.writeTo(out, LOCATION);
+        return id;
+    }
+    
+    // One call stack, innermost frame first, with its PROFILE_VALUES values.
+    void sample(const std::vector<ProfileFrame>& frames, const int64_t* values) {
+        std::vector<uint64_t> ids(frames.size());
+        for (size_t i = 0; i < frames.size(); i++) {
+            ids[i] = locationId(frames[i]);
+        }
+        uint64_t encoded[PROFILE_VALUES];
+        for (size_t i = 0; i < PROFILE_VALUES; i++) {
+            encoded[i] = static_cast<uint64_t>(values[i]);
+        }
+        ProtoBuffer sample;
+        sample.packed(1, ids.data(), ids.size());
+        sample.packed(2, encoded, PROFILE_VALUES);
+        if (sample.complete()) {
+            sample.writeTo(out, SAMPLE);
+        }
+    }
+    
+    void finish(int64_t timeNanos, int64_t durationNanos) {
+        for (size_t i = 0; i < stringOrder.size(); i++) {
+            ProtoBuffer header;
+            header.varint((uint64_t(STRING_TABLE) << 3) | 2);
+            header.varint(stringOrder[i]->size());
+            header.writeRaw(out);
+            out.write(stringOrder[i]->data(), static_cast<std::streamsize>(stringOrder[i]->size()));
+        }
+        ProtoBuffer tail;
+        tail.field(TIME_NANOS, static_cast<uint64_t>(timeNanos));
+        tail.field(DURATION_NANOS, static_cast<uint64_t>(durationNanos));
+        tail.writeRaw(out);
+    }
+};
+
+inline void writeJsonString(std::ostream& out, const std::string& text) {
+    out << '"';
+    for (size_t i = 0; i < text.size(); i++) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c == '"' || c == '\\') {
+            out << '\\' << text[i];
+        } else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out << escaped;
+        } else {
+            out << text[i];
+        }
+    }
+    out << '"';
+}
+
+// Streams the JSON format: one object with the totals and a "sites" array,
+// one site per line:
+//     {"format":"memprof-profile-1","processes":1,...,"sites":[
+//     {"site":"main.cpp:12","stack":[],"allocations":3,"bytes":96,"live":1,"live_bytes":32},
+//     ...]}
+class JsonProfileWriter {
+private:
+    std::ostream& out;
+    bool first;
+
+public:
+    JsonProfileWriter(std::ostream& stream, const ProfileTotals& totals) : out(stream), first(true) {
+        out << "{\"format\":\"" << PROFILE_JSON_FORMAT << '"';
+        for (size_t i = 0; i < PROFILE_TOTALS; i++) {
+            out << ",\"" << PROFILE_TOTAL_KEYS[i] << "\":" << totals.*PROFILE_TOTAL_FIELDS[i];
+        }
+        out << ",\"sites\":[";
+    }
+    
+    void site(const std::string& name, const std::vector<std::string>& stack, const int64_t* values) {
+        out << (first ? "\n{\"site\":" : ",\n{\"site\":");
+        first = false;
+        writeJsonString(out, name);
+        out << ",\"stack\":[";
+        for (size_t i = 0; i < stack.size(); i++) {
+            if (i) {
+                out << ',';
+            }
+            writeJsonString(out, stack[i]);
+        }
+        out << ']';
+        for (size_t i = 0; i < PROFILE_VALUES; i++) {
+            out << ",\"" << PROFILE_JSON_KEYS[i] << "\":" << values[i];
+        }
+        out << '}';
+    }
+    
+    void finish() {
+        out << "]}\n";
+    }
+};
+
+#endif
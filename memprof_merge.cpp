@@ -0,0 +1,650 @@
+// Combines profiles written by MemoryProfiler::exportPprof or exportJson
+// (MEMPROF_PPROF / MEMPROF_JSON with libmemprof.so) from many processes or
+// hosts into one. Values of identical call stacks are added up; JSON totals
+// are summed, so peak_bytes becomes the sum of the peaks. Each input is
+// read once and stacks are matched through a hash table, so the cost is
+// linear in the total input size.
+//
+//     make memprof_merge
+//     ./memprof_merge -o merged.pb host1.pb host2.pb ...
+//     ./memprof_merge -o merged.json host1.json host2.json ...
+//
+// The output is JSON when its name ends in .json and pprof otherwise.
+// Inputs may mix both formats: frames from either are reduced to the same
+// labels (function, or file:line when known, without the code offset), so
+// the same stack matches across formats.
+// Gzipped pprof files must be decompressed first.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdlib>
+#include "memprof_export.h"
+
+// Decoder for the parts of profile.proto the merge needs.
+class ProtoReader {
+private:
+    const unsigned char* cursor;
+    const unsigned char* end;
+    bool valid;
+
+public:
+    ProtoReader(const unsigned char* data, size_t size) : cursor(data), end(data + size), valid(true) {}
+    
+    bool ok() const { return valid; }
+    bool done() const { return cursor >= end || !valid; }
+    
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (cursor >= end) {
+                valid = false;
+                return 0;
+            }
+            unsigned char byte = *cursor++;
+            value |= uint64_t(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        valid = false;
+        return 0;
+    }
+    
+    // Reads the next key; wire type 2 fields are then read with bytes().
+    bool next(uint32_t& field, uint32_t& wire) {
+        if (done()) {
+            return false;
+        }
+        uint64_t key = varint();
+        field = static_cast<uint32_t>(key >> 3);
+        wire = static_cast<uint32_t>(key & 7);
+        return valid;
+    }
+    
+    ProtoReader bytes() {
+        uint64_t size = varint();
+        if (!valid || size > static_cast<uint64_t>(end - cursor)) {
+            valid = false;
+            return ProtoReader(end, 0);
+        }
+        ProtoReader inner(cursor, static_cast<size_t>(size));
+        cursor += size;
+        return inner;
+    }
+    
+    std::string string() {
+        ProtoReader inner = bytes();
+        return std::string(reinterpret_cast<const char*>(inner.cursor), static_cast<size_t>(inner.end - inner.cursor));
+    }
+    
+    // A repeated integer field, packed or not.
+    void integers(uint32_t wire, std::vector<uint64_t>& out) {
+        if (wire == 2) {
+            ProtoReader packed = bytes();
+            while (!packed.done()) {
+                out.push_back(packed.varint());
+            }
+            valid = valid && packed.ok();
+        } else {
+            out.push_back(varint());
+        }
+    }
+    
+    void skip(uint32_t wire) {
+        switch (wire) {
+            case 0: varint(); break;
+            case 1: cursor += 8; break;
+            case 2: bytes(); break;
+            case 5: cursor += 4; break;
+            default: valid = false; break;
+        }
+        if (cursor > end) {
+            valid = false;
+        }
+    }
+};
+
+struct MergedSite {
+    std::string name;
+    std::vector<std::string> stack;
+    std::vector<ProfileFrame> frames;
+    int64_t values[PROFILE_VALUES];
+};
+
+class ProfileMerger {
+private:
+    ProfileTotals totals;
+    size_t inputs;
+    std::vector<MergedSite> sites;
+    std::unordered_map<std::string, size_t> siteIndex;
+    
+    void add(const std::string& name, const std::vector<std::string>& stack, const std::vector<ProfileFrame>& frames,
+             const int64_t* values) {
+        std::string key = name;
+        for (size_t i = 0; i < stack.size(); i++) {
+            key += '\n';
+            key += stack[i];
+        }
+        std::unordered_map<std::string, size_t>::iterator it = siteIndex.find(key);
+        if (it == siteIndex.end()) {
+            MergedSite site;
+            site.name = name;
+            site.stack = stack;
+            site.frames = frames;
+            for (size_t i = 0; i < PROFILE_VALUES; i++) {
+                site.values[i] = 0;
+            }
+            it = siteIndex.insert(std::make_pair(key, sites.size())).first;
+            sites.push_back(site);
+        }
+        MergedSite& site = sites[it->second];
+        for (size_t i = 0; i < PROFILE_VALUES; i++) {
+            site.values[i] += values[i];
+        }
+    }
+    
+    void addTotals(const ProfileTotals& file) {
+        for (size_t i = 0; i < PROFILE_TOTALS; i++) {
+            totals.*PROFILE_TOTAL_FIELDS[i] += file.*PROFILE_TOTAL_FIELDS[i];
+        }
+        inputs++;
+    }
+    
+    // Sample from either input: named after its innermost frame, with the
+    // whole stack as the key when there is more than one frame.
+    void addFrames(std::vector<ProfileFrame>& frames, const int64_t* values) {
+        if (frames.empty()) {
+            ProfileFrame frame = {"unknown", "", 0, 0};
+            frames.push_back(frame);
+        }
+        std::vector<std::string> stack;
+        for (size_t i = 0; frames.size() > 1 && i < frames.size(); i++) {
+            stack.push_back(frameLabel(frames[i]));
+        }
+        // Addresses differ between processes; the merged profile drops them.
+        for (size_t i = 0; i < frames.size(); i++) {
+            frames[i].address = 0;
+        }
+        add(frameLabel(frames[0]), stack, frames, values);
+    }
+    
+    bool loadPprof(const std::string& data, const std::string& path) {
+        struct Function {
+            uint64_t name;
+            uint64_t file;
+        };
+        struct Location {
+            std::vector<uint64_t> functions;
+            std::vector<uint64_t> lines;
+        };
+        struct Sample {
+            std::vector<uint64_t> locations;
+            std::vector<uint64_t> values;
+        };
+        std::vector<std::string> strings;
+        std::vector<uint64_t> typeNames;
+        std::vector<uint64_t> comments;
+        std::unordered_map<uint64_t, Function> functions;
+        std::unordered_map<uint64_t, Location> locations;
+        std::vector<Sample> samples;
+        
+        ProtoReader profile(reinterpret_cast<const unsigned char*>(data.data()), data.size());
+        uint32_t field;
+        uint32_t wire;
+        while (profile.next(field, wire)) {
+            if (field == 13) {
+                profile.integers(wire, comments);
+                continue;
+            }
+            if (wire != 2) {
+                profile.skip(wire);
+                continue;
+            }
+            if (field == 6) {
+                strings.push_back(profile.string());
+                continue;
+            }
+            ProtoReader message = profile.bytes();
+            uint32_t inner;
+            uint32_t innerWire;
+            if (field == 1) {
+                uint64_t type = 0;
+                while (message.next(inner, innerWire)) {
+                    if (inner == 1 && innerWire == 0) {
+                        type = message.varint();
+                    } else {
+                        message.skip(innerWire);
+                    }
+                }
+                typeNames.push_back(type);
+            } else if (field == 2) {
+                Sample sample;
+                while (message.next(inner, innerWire)) {
+                    if (inner == 1) {
+                        message.integers(innerWire, sample.locations);
+                    } else if (inner == 2) {
+                        message.integers(innerWire, sample.values);
+                    } else {
+                        message.skip(innerWire);
+                    }
+                }
+                samples.push_back(sample);
+            } else if (field == 4) {
+                uint64_t id = 0;
+                Location location;
+                while (message.next(inner, innerWire)) {
+                    if (inner == 1 && innerWire == 0) {
+                        id = message.varint();
+                    } else if (inner == 4 && innerWire == 2) {
+                        ProtoReader line = message.bytes();
+                        uint64_t function = 0;
+                        uint64_t number = 0;
+                        uint32_t lineField;
+                        uint32_t lineWire;
+                        while (line.next(lineField, lineWire)) {
+                            if (lineField == 1 && lineWire == 0) {
+                                function = line.varint();
+                            } else if (lineField == 2 && lineWire == 0) {
+                                number = line.varint();
+                            } else {
+                                line.skip(lineWire);
+                            }
+                        }
+                        location.functions.push_back(function);
+                        location.lines.push_back(number);
+                    } else {
+                        message.skip(innerWire);
+                    }
+                }
+                locations[id] = location;
+            } else if (field == 5) {
+                uint64_t id = 0;
+                Function function = {0, 0};
+                while (message.next(inner, innerWire)) {
+                    if (inner == 1 && innerWire == 0) {
+                        id = message.varint();
+                    } else if (inner == 2 && innerWire == 0) {
+                        function.name = message.varint();
+                    } else if (inner == 4 && innerWire == 0) {
+                        function.file = message.varint();
+                    } else {
+                        message.skip(innerWire);
+                    }
+                }
+                functions[id] = function;
+            }
+            if (!message.ok()) {
+                break;
+            }
+        }
+        if (!profile.ok() || strings.empty()) {
+            std::cerr << "[ERROR] " << path << " is not a valid pprof profile\n";
+            return false;
+        }
+        
+        // Input value index for each of ours, by sample type name.
+        std::vector<int> column(PROFILE_VALUES, -1);
+        for (size_t t = 0; t < typeNames.size(); t++) {
+            for (size_t i = 0; i < PROFILE_VALUES && typeNames[t] < strings.size(); i++) {
+                if (strings[typeNames[t]] == PROFILE_SAMPLE_TYPES[i]) {
+                    column[i] = static_cast<int>(t);
+                }
+            }
+        }
+        std::vector<ProfileFrame> frames;
+        for (size_t s = 0; s < samples.size(); s++) {
+            const Sample& sample = samples[s];
+            int64_t values[PROFILE_VALUES];
+            for (size_t i = 0; i < PROFILE_VALUES; i++) {
+                bool present = column[i] >= 0 && static_cast<size_t>(column[i]) < sample.values.size();
+                values[i] = present ? static_cast<int64_t>(sample.values[column[i]]) : 0;
+            }
+            frames.clear();
+            for (size_t l = 0; l < sample.locations.size(); l++) {
+                std::unordered_map<uint64_t, Location>::const_iterator location = locations.find(sample.locations[l]);
+                if (location == locations.end()) {
+                    continue;
+                }
+                // Inlined functions come first, the function they were inlined into last.
+                for (size_t i = 0; i < location->second.functions.size(); i++) {
+                    std::unordered_map<uint64_t, Function>::const_iterator function =
+                        functions.find(location->second.functions[i]);
+                    ProfileFrame frame = {"unknown", "", static_cast<int64_t>(location->second.lines[i]), 0};
+                    if (function != functions.end()) {
+                        frame.function = function->second.name < strings.size() ? strings[function->second.name] : "";
+                        frame.file = function->second.file < strings.size() ? strings[function->second.file] : "";
+                    }
+                    frames.push_back(frame);
+                }
+            }
+            addFrames(frames, values);
+        }
+        
+        // Totals written by PprofWriter::totals; other profiles count as
+        // one process.
+        ProfileTotals file = {1, 0, 0, 0, 0};
+        std::string prefix = PROFILE_COMMENT_PREFIX;
+        for (size_t c = 0; c < comments.size(); c++) {
+            const std::string& comment = comments[c] < strings.size() ? strings[comments[c]] : strings[0];
+            for (size_t i = 0; i < PROFILE_TOTALS && comment.compare(0, prefix.size(), prefix) == 0; i++) {
+                std::string key = prefix + PROFILE_TOTAL_KEYS[i] + "=";
+                if (comment.compare(0, key.size(), key) == 0) {
+                    file.*PROFILE_TOTAL_FIELDS[i] = strtoull(comment.c_str() + key.size(), NULL, 10);
+                }
+            }
+        }
+        addTotals(file);
+        return true;
+    }
+    
+    bool loadJson(const std::string& data, const std::string& path);
+
+public:
+    ProfileMerger() {
+        ProfileTotals none = {0, 0, 0, 0, 0};
+        totals = none;
+        inputs = 0;
+    }
+    
+    bool load(const std::string& path) {
+        std::ifstream in(path.c_str(), std::ios::binary);
+        if (!in) {
+            std::cerr << "[ERROR] Cannot read " << path << "\n";
+            return false;
+        }
+        std::ostringstream content;
+        content << in.rdbuf();
+        std::string data = content.str();
+        if (data.size() >= 2 && static_cast<unsigned char>(data[0]) == 0x1f &&
+            static_cast<unsigned char>(data[1]) == 0x8b) {
+            std::cerr << "[ERROR] " << path << " is gzipped; decompress it first\n";
+            return false;
+        }
+        size_t first = data.find_first_not_of(" \t\r\n");
+        if (first != std::string::npos && data[first] == '{') {
+            return loadJson(data, path);
+        }
+        return loadPprof(data, path);
+    }
+    
+    bool write(const std::string& path) {
+        std::vector<char> buffer(size_t(1) << 20);
+        std::ofstream out;
+        out.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        out.open(path.c_str(), std::ios::binary);
+        if (!out) {
+            std::cerr << "[ERROR] Cannot write " << path << "\n";
+            return false;
+        }
+        if (path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0) {
+            JsonProfileWriter writer(out, totals);
+            for (size_t i = 0; i < sites.size(); i++) {
+                writer.site(sites[i].name, sites[i].stack, sites[i].values);
+            }
+            writer.finish();
+        } else {
+            PprofWriter writer(out);
+            writer.totals(totals);
+            for (size_t i = 0; i < sites.size(); i++) {
+                writer.sample(sites[i].frames, sites[i].values);
+            }
+            writer.finish(0, 0);
+        }
+        out.close();
+        if (out.fail()) {
+            std::cerr << "[ERROR] Cannot write " << path << "\n";
+            return false;
+        }
+        std::cout << "Merged " << inputs << " profiles (" << totals.processes << " processes, " << sites.size()
+                  << " call stacks) into " << path << "\n";
+        return true;
+    }
+};
+
+// Reads the JSON format of JsonProfileWriter. Unknown keys are skipped, so
+// files from newer versions with extra fields still merge.
+class JsonProfileReader {
+private:
+    const std::string& text;
+    size_t pos;
+    
+    void skipSpace() {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\n' || text[pos] == '\r' || text[pos] == '\t')) {
+            pos++;
+        }
+    }
+    
+    bool consume(char c) {
+        skipSpace();
+        if (pos < text.size() && text[pos] == c) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+public:
+    explicit JsonProfileReader(const std::string& content) : text(content), pos(0) {}
+    
+    bool string(std::string& out) {
+        out.clear();
+        if (!consume('"')) {
+            return false;
+        }
+        while (pos < text.size() && text[pos] != '"') {
+            char c = text[pos++];
+            if (c == '\\' && pos < text.size()) {
+                char escaped = text[pos++];
+                switch (escaped) {
+                    case 'n': out += '\n'; break;
+                    case 't': out += '\t'; break;
+                    case 'r': out += '\r'; break;
+                    case 'u':
+                        out += static_cast<char>(strtol(text.substr(pos, 4).c_str(), NULL, 16));
+                        pos += 4;
+                        break;
+                    default: out += escaped; break;
+                }
+            } else {
+                out += c;
+            }
+        }
+        return consume('"');
+    }
+    
+    bool number(int64_t& out) {
+        skipSpace();
+        char* end = NULL;
+        out = strtoll(text.c_str() + pos, &end, 10);
+        if (end == text.c_str() + pos) {
+            return false;
+        }
+        pos = static_cast<size_t>(end - text.c_str());
+        // Fractions and exponents are not written by the exporter.
+        while (pos < text.size() && (text[pos] == '.' || text[pos] == 'e' || text[pos] == 'E' || text[pos] == '+' ||
+                                     text[pos] == '-' || (text[pos] >= '0' && text[pos] <= '9'))) {
+            pos++;
+        }
+        return true;
+    }
+    
+    bool skipValue() {
+        skipSpace();
+        if (pos >= text.size()) {
+            return false;
+        }
+        std::string ignored;
+        if (text[pos] == '"') {
+            return string(ignored);
+        }
+        if (text[pos] == '[' || text[pos] == '{') {
+            char close = text[pos] == '[' ? ']' : '}';
+            pos++;
+            if (consume(close)) {
+                return true;
+            }
+            do {
+                if (close == '}' && !(string(ignored) && consume(':'))) {
+                    return false;
+                }
+                if (!skipValue()) {
+                    return false;
+                }
+            } while (consume(','));
+            return consume(close);
+        }
+        while (pos < text.size() && text[pos] != ',' && text[pos] != '}' && text[pos] != ']') {
+            pos++;
+        }
+        return true;
+    }
+    
+    // Calls visit(key) for each member of an object; visit reads the value.
+    template <typename Visitor>
+    bool object(Visitor visit) {
+        if (!consume('{')) {
+            return false;
+        }
+        if (consume('}')) {
+            return true;
+        }
+        do {
+            std::string key;
+            if (!string(key) || !consume(':') || !visit(key)) {
+                return false;
+            }
+        } while (consume(','));
+        return consume('}');
+    }
+    
+    template <typename Visitor>
+    bool array(Visitor visit) {
+        if (!consume('[')) {
+            return false;
+        }
+        if (consume(']')) {
+            return true;
+        }
+        do {
+            if (!visit()) {
+                return false;
+            }
+        } while (consume(','));
+        return consume(']');
+    }
+};
+
+// Takes the file and line from a site name of the form "file:line".
+static void splitFileLine(const std::string& name, ProfileFrame& frame) {
+    size_t colon = name.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == name.size() ||
+        name.find_first_not_of("0123456789", colon + 1) != std::string::npos) {
+        return;
+    }
+    frame.file = name.substr(0, colon);
+    frame.line = atoll(name.c_str() + colon + 1);
+}
+
+bool ProfileMerger::loadJson(const std::string& data, const std::string& path) {
+    JsonProfileReader reader(data);
+    ProfileTotals file = {1, 0, 0, 0, 0};
+    std::string format;
+    std::string name;
+    std::vector<std::string> stack;
+    std::vector<ProfileFrame> frames;
+    int64_t values[PROFILE_VALUES];
+    
+    auto readSiteMember = [&](const std::string& key) {
+        if (key == "site") {
+            return reader.string(name);
+        }
+        if (key == "stack") {
+            return reader.array([&]() {
+                std::string frame;
+                bool ok = reader.string(frame);
+                stack.push_back(frame);
+                return ok;
+            });
+        }
+        for (size_t i = 0; i < PROFILE_VALUES; i++) {
+            if (key == PROFILE_JSON_KEYS[i]) {
+                return reader.number(values[i]);
+            }
+        }
+        return reader.skipValue();
+    };
+    auto readSite = [&]() {
+        name.clear();
+        stack.clear();
+        for (size_t i = 0; i < PROFILE_VALUES; i++) {
+            values[i] = 0;
+        }
+        if (!reader.object(readSiteMember)) {
+            return false;
+        }
+        // Rebuild the frames exportPprof writes for the site: the name is
+        // the innermost frame, or its source line when the site has one.
+        frames.clear();
+        for (size_t i = 0; i < stack.size(); i++) {
+            frames.push_back(frameFromSymbol(stack[i], 0));
+        }
+        if (frames.empty()) {
+            frames.push_back(frameFromSymbol(name, 0));
+        }
+        splitFileLine(name, frames[0]);
+        addFrames(frames, values);
+        return true;
+    };
+    bool ok = reader.object([&](const std::string& key) {
+        if (key == "format") {
+            return reader.string(format);
+        }
+        for (size_t i = 0; i < PROFILE_TOTALS; i++) {
+            if (key == PROFILE_TOTAL_KEYS[i]) {
+                int64_t value = 0;
+                bool read = reader.number(value);
+                file.*PROFILE_TOTAL_FIELDS[i] = static_cast<uint64_t>(value);
+                return read;
+            }
+        }
+        if (key == "sites") {
+            return reader.array(readSite);
+        }
+        return reader.skipValue();
+    });
+    if (!ok || format != PROFILE_JSON_FORMAT) {
+        std::cerr << "[ERROR] " << path << " is not a memory profiler JSON profile\n";
+        return false;
+    }
+    addTotals(file);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::string output;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            output = argv[++i];
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    if (output.empty() || inputs.empty()) {
+        std::cerr << "Usage: " << argv[0] << " -o merged.(pb|json) profile...\n";
+        return 1;
+    }
+    
+    ProfileMerger merger;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        if (!merger.load(inputs[i])) {
+            return 1;
+        }
+    }
+    return merger.write(output) ? 0 : 1;
+}
@@ -0,0 +1,28 @@
+#ifndef MEMPROF_POLICY_H
+#define MEMPROF_POLICY_H
+
+// What the profiler records, chosen at compile time. Each switch removes
+// its work from the allocation path entirely:
+//   siteAggregation  per-site counters and histograms; stack capture needs it
+//   timestamps       allocation times, used for lifetimes, peaks and snapshots
+//   stackCapture     call stacks of recorded allocations (see setStackDepth)
+//   threadIds        the allocating thread of each record
+//   leakTracking     the live allocation table; without it only allocation
+//                    and free counts are kept, with no usage, peak or leaks
+// With `enabled` off nothing is recorded, and the allocation hooks in
+// memory_profiler.h call malloc and free directly. A policy derives from
+// one of these and overrides the switches it changes.
+struct DefaultProfilerPolicy {
+    static constexpr bool enabled = true;
+    static constexpr bool siteAggregation = true;
+    static constexpr bool timestamps = true;
+    static constexpr bool stackCapture = true;
+    static constexpr bool threadIds = true;
+    static constexpr bool leakTracking = true;
+};
+
+struct DisabledProfilerPolicy : DefaultProfilerPolicy {
+    static constexpr bool enabled = false;
+};
+
+#endif
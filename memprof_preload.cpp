@@ -0,0 +1,240 @@
+// Shared library that profiles an unmodified binary through LD_PRELOAD.
+//
+//     make libmemprof.so
+//     LD_PRELOAD=./libmemprof.so ./your_program
+//
+// The C allocation functions are interposed and forwarded to glibc's
+// __libc_* entry points; C++ new/delete reach them through libstdc++.
+// Every allocation is keyed by its caller's address. At exit the summary
+// goes to stderr and the HTML report to $MEMPROF_REPORT (default
+// memprof_<pid>.html). Other environment variables:
+//
+//     MEMPROF_SAMPLE_INTERVAL=<bytes>   sample one allocation per <bytes>
+//     MEMPROF_SIGNAL=<number>           also write the report on this signal
+//     MEMPROF_STACK_DEPTH=<frames>      group allocations by call stack
+//     MEMPROF_TIMELINE_MS=<ms>          chart usage over time at this interval
+//     MEMPROF_SOCKET=<path>             serve live stats to memprof_client
+//     MEMPROF_TRACE=<path>              stream events to a trace file for
+//                                       memprof_analyze instead of keeping
+//                                       them in memory
+//     MEMPROF_QUARANTINE=<bytes>        hold up to <bytes> of freed blocks
+//                                       to catch double and invalid frees
+//                                       and writes after free
+//     MEMPROF_PPROF=<path>              also write a pprof heap profile
+//     MEMPROF_JSON=<path>               also write a JSON profile for
+//                                       memprof_merge
+//
+// Build with -ftls-model=initial-exec so the profiler's thread_locals never
+// call back into malloc when a thread first touches them.
+
+#define MEMPROF_NO_GLOBAL_HOOKS
+#define MEMPROF_NO_NEW_MACRO
+#include "memory_profiler.h"
+
+#include <malloc.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+void* __libc_memalign(size_t alignment, size_t size);
+}
+
+#define MEMPROF_EXPORT extern "C" __attribute__((visibility("default")))
+
+namespace {
+
+sem_t reportRequest;
+
+std::string reportPath() {
+    const char* path = getenv("MEMPROF_REPORT");
+    if (path && *path) {
+        return path;
+    }
+    return "memprof_" + std::to_string(getpid()) + ".html";
+}
+
+void exportProfile(const char* variable, bool (MemoryProfiler::*write)(const std::string&)) {
+    const char* path = getenv(variable);
+    if (path && *path && !(MemoryProfiler::getInstance().*write)(path)) {
+        std::cerr << "memprof: cannot write " << path << "\n";
+    }
+}
+
+void writeReport() {
+    MemoryProfiler& profiler = MemoryProfiler::getInstance();
+    profiler.detectLeaks();
+    profiler.printSummary();
+    profiler.generateHTMLReport(reportPath());
+    exportProfile("MEMPROF_PPROF", &MemoryProfiler::exportPprof);
+    exportProfile("MEMPROF_JSON", &MemoryProfiler::exportJson);
+}
+
+void onReportSignal(int) {
+    // sem_post is async-signal-safe; the report is written on its own thread.
+    sem_post(&reportRequest);
+}
+
+void* reportThread(void*) {
+    for (;;) {
+        if (sem_wait(&reportRequest) == 0) {
+            writeReport();
+        }
+    }
+    return NULL;
+}
+
+inline void* track(void* ptr, size_t size, const void* caller) {
+    if (ptr) {
+        MemoryProfiler::getInstance().recordAllocation(ptr, size, NULL, 0, caller);
+    }
+    return ptr;
+}
+
+__attribute__((constructor)) void startProfiler() {
+    MemoryProfiler& profiler = MemoryProfiler::getInstance();
+    profiler.setLogStream(std::cerr);
+    
+    const char* interval = getenv("MEMPROF_SAMPLE_INTERVAL");
+    if (interval && *interval) {
+        profiler.setSamplingInterval(strtoul(interval, NULL, 10));
+    }
+    
+    const char* depth = getenv("MEMPROF_STACK_DEPTH");
+    if (depth && *depth) {
+        profiler.setStackDepth(static_cast<uint32_t>(strtoul(depth, NULL, 10)));
+    }
+    
+    const char* timeline = getenv("MEMPROF_TIMELINE_MS");
+    if (timeline && *timeline) {
+        profiler.setTimelineInterval(strtoul(timeline, NULL, 10));
+    }
+    
+    const char* socketPath = getenv("MEMPROF_SOCKET");
+    if (socketPath && *socketPath && !profiler.startIntrospection(socketPath)) {
+        std::cerr << "memprof: cannot listen on " << socketPath << "\n";
+    }
+    
+    const char* quarantine = getenv("MEMPROF_QUARANTINE");
+    if (quarantine && *quarantine && !profiler.setQuarantine(strtoul(quarantine, NULL, 10), __libc_free)) {
+        std::cerr << "memprof: cannot set up the quarantine\n";
+    }
+    
+    const char* trace = getenv("MEMPROF_TRACE");
+    if (trace && *trace && !profiler.startStreaming(trace)) {
+        std::cerr << "memprof: cannot write trace " << trace << "\n";
+    }
+    
+    const char* signalName = getenv("MEMPROF_SIGNAL");
+    int signalNumber = signalName ? atoi(signalName) : 0;
+    if (signalNumber > 0 && signalNumber < NSIG) {
+        pthread_t thread;
+        sem_init(&reportRequest, 0, 0);
+        if (pthread_create(&thread, NULL, reportThread, NULL) == 0) {
+            pthread_detach(thread);
+            struct sigaction action;
+            memset(&action, 0, sizeof(action));
+            action.sa_handler = onReportSignal;
+            action.sa_flags = SA_RESTART;
+            sigemptyset(&action.sa_mask);
+            sigaction(signalNumber, &action, NULL);
+        }
+    }
+}
+
+__attribute__((destructor)) void stopProfiler() {
+    MemoryProfiler& profiler = MemoryProfiler::getInstance();
+    if (profiler.isStreaming()) {
+        profiler.stopStreaming();
+        profiler.printSummary();
+        return;
+    }
+    writeReport();
+}
+
+}
+
+MEMPROF_EXPORT void* malloc(size_t size) {
+    return track(__libc_malloc(size), size, __builtin_return_address(0));
+}
+
+MEMPROF_EXPORT void* calloc(size_t count, size_t size) {
+    return track(__libc_calloc(count, size), count * size, __builtin_return_address(0));
+}
+
+MEMPROF_EXPORT void* realloc(void* ptr, size_t size) {
+    const void* caller = __builtin_return_address(0);
+    if (!ptr) {
+        return track(__libc_malloc(size), size, caller);
+    }
+    
+    MemoryProfiler& profiler = MemoryProfiler::getInstance();
+    size_t trackedSize = profiler.trackedSize(ptr);
+    if (trackedSize != 0 && profiler.getQuarantineBudget() != 0) {
+        // Always moved, so the old block can wait in the quarantine.
+        void* moved = size != 0 ? track(__libc_malloc(size), size, caller) : NULL;
+        if (size != 0 && !moved) {
+            return NULL;
+        }
+        if (moved) {
+            memcpy(moved, ptr, trackedSize < size ? trackedSize : size);
+        }
+        if (profiler.recordDeallocation(ptr, ALLOC_PLAIN, caller)) {
+            __libc_free(ptr);
+        }
+        return moved;
+    }
+    
+    // The old record leaves the table before glibc can hand its address to
+    // another thread. It is only counted as freed once the resize succeeds
+    // and goes back unchanged if it fails.
+    AllocationInfo record;
+    if (profiler.detachAllocation(ptr, record)) {
+        void* resized = __libc_realloc(ptr, size);
+        if (!resized && size != 0) {
+            profiler.reattachAllocation(record);
+            return NULL;
+        }
+        profiler.releaseDetached(record);
+        return track(resized, size, caller);
+    }
+    if (!profiler.recordDeallocation(ptr, ALLOC_PLAIN, caller)) {
+        return NULL;
+    }
+    return track(__libc_realloc(ptr, size), size, caller);
+}
+
+MEMPROF_EXPORT void free(void* ptr) {
+    if (ptr && MemoryProfiler::getInstance().recordDeallocation(ptr, ALLOC_PLAIN, __builtin_return_address(0))) {
+        __libc_free(ptr);
+    }
+}
+
+MEMPROF_EXPORT int posix_memalign(void** out, size_t alignment, size_t size) {
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void* ptr = __libc_memalign(alignment, size);
+    if (!ptr) {
+        return ENOMEM;
+    }
+    *out = track(ptr, size, __builtin_return_address(0));
+    return 0;
+}
+
+MEMPROF_EXPORT void* aligned_alloc(size_t alignment, size_t size) {
+    return track(__libc_memalign(alignment, size), size, __builtin_return_address(0));
+}
+
+MEMPROF_EXPORT void* memalign(size_t alignment, size_t size) {
+    return track(__libc_memalign(alignment, size), size, __builtin_return_address(0));
+}
+
+MEMPROF_EXPORT void* valloc(size_t size) {
+    return track(__libc_memalign(static_cast<size_t>(sysconf(_SC_PAGESIZE)), size), size,
+                 __builtin_return_address(0));
+}
@@ -0,0 +1,52 @@
+#ifndef MEMPROF_TRACE_H
+#define MEMPROF_TRACE_H
+
+#include <cstdint>
+#include <cstring>
+
+// On-disk format of the streaming trace written by MemoryProfiler and read
+// by memprof_analyze. The file is a TraceHeader followed by fixed-size
+// TraceEvents in the order they were flushed, which is only roughly time
+// order across threads. A SITE event is followed by the site's name,
+// padded to whole events; it always precedes the first event that uses
+// its id. A zero type marks the end of a trace that was not closed.
+
+static const char TRACE_MAGIC[8] = {'M', 'E', 'M', 'P', 'R', 'O', 'F', '1'};
+static const uint32_t TRACE_VERSION = 1;
+
+enum TraceEventType {
+    TRACE_END = 0,
+    TRACE_ALLOC = 1,
+    TRACE_FREE = 2,
+    TRACE_SITE = 3
+};
+
+struct TraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t eventSize;
+    uint64_t startNanos;
+    int64_t startWallClock;
+    uint64_t samplingInterval;  // 0 when every allocation is recorded
+    uint64_t reserved[3];
+};
+
+struct TraceEvent {
+    uint64_t timestamp;
+    uint64_t address;
+    uint64_t size;          // bytes for ALLOC, name length for SITE
+    uint32_t siteId;
+    uint32_t typeAndThread; // event type in the top 4 bits, thread id below
+    
+    static uint32_t pack(TraceEventType type, int threadId) {
+        return (static_cast<uint32_t>(type) << 28) | (static_cast<uint32_t>(threadId) & 0x0fffffffu);
+    }
+    
+    TraceEventType type() const { return static_cast<TraceEventType>(typeAndThread >> 28); }
+    int threadId() const { return static_cast<int>(typeAndThread & 0x0fffffffu); }
+};
+
+static_assert(sizeof(TraceHeader) == 64, "trace header layout changed");
+static_assert(sizeof(TraceEvent) == 32, "trace event layout changed");
+
+#endif